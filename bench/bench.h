@@ -0,0 +1,130 @@
+/*
+ *  cquel - MySQL C API wrapper with dynamic data structures
+ *  Copyright (C) 2014 Delwink, LLC
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as published by
+ *  the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* helpers shared by the benchmarks, which are built with "make bench" */
+
+#ifndef CQUEL_BENCH_H
+#define CQUEL_BENCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../cquel.h"
+
+#define BENCH_TABLE "cq_bench"
+
+static inline double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static inline void bench_report(const char *what, size_t n,
+        const char *unit, double secs)
+{
+    printf("%-24s %10zu %s %9.3f s %12.0f %s/s\n", what, n, unit, secs,
+            secs > 0 ? n / secs : 0.0, unit);
+}
+
+/* arguments are HOST USER PASSWD DATABASE [ROWS] */
+static inline int bench_connect(int argc, char **argv,
+        struct dbconn *con, size_t *rows)
+{
+    if (argc < 5) {
+        fprintf(stderr, "usage: %s HOST USER PASSWD DATABASE [ROWS]\n",
+                argv[0]);
+        return 1;
+    }
+
+    if (argc > 5)
+        *rows = strtoul(argv[5], NULL, 10);
+
+    cq_init(1 << 20, 64);
+    *con = cq_new_connection(argv[1], argv[2], argv[3], argv[4]);
+    if (cq_connect(con)) {
+        fprintf(stderr, "%s: could not connect\n", argv[0]);
+        return 2;
+    }
+
+    return 0;
+}
+
+/* runs statements one after another, stopping at the first failure */
+static inline int bench_exec(struct dbconn con, const char * const *stmts,
+        size_t n)
+{
+    struct cq_pipeline *p = cq_new_pipeline();
+    if (p == NULL)
+        return -1;
+
+    int rc = 0;
+    for (size_t i = 0; i < n && !rc; ++i)
+        rc = cq_pipeline_add(p, stmts[i]);
+    if (!rc)
+        rc = cq_pipeline_run(con, p);
+
+    cq_free_pipeline(p);
+    return rc;
+}
+
+/* empties the benchmark table, creating it if need be */
+static inline int bench_table(struct dbconn con)
+{
+    static const char * const stmts[] = {
+        "DROP TABLE IF EXISTS " BENCH_TABLE,
+        "CREATE TABLE " BENCH_TABLE " (id INT PRIMARY KEY, name VARCHAR(32), "
+                "note VARCHAR(64), score DOUBLE)"
+    };
+
+    return bench_exec(con, stmts, 2);
+}
+
+/* a list of n rows for the benchmark table, with some values to escape */
+static inline struct dlist *bench_rows(size_t n)
+{
+    static char * const fields[] = { "id", "name", "note", "score" };
+    char id[24], name[32], note[64], score[32];
+    char * const values[] = { id, name, note, score };
+
+    struct dlist *list = cq_new_dlist(4, fields, "id");
+    if (list == NULL || cq_dlist_use_arena(list)) {
+        cq_free_dlist(list);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+        snprintf(id, sizeof id, "%zu", i + 1);
+        snprintf(name, sizeof name, "name %zu", i % 1000);
+        snprintf(note, sizeof note, "%s row\t%zu", i % 7 ? "plain" : "it's a",
+                i);
+        snprintf(score, sizeof score, "%zu.%02zu", i % 100, i % 97);
+
+        struct drow *row = cq_dlist_new_drow(list);
+        if (row == NULL || cq_drow_set(row, values)) {
+            cq_free_dlist(list);
+            return NULL;
+        }
+        cq_dlist_add(list, row);
+    }
+
+    return list;
+}
+
+#endif
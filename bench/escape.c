@@ -0,0 +1,134 @@
+/*
+ *  cquel - MySQL C API wrapper with dynamic data structures
+ *  Copyright (C) 2014 Delwink, LLC
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as published by
+ *  the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* times the vectorized escape kernel against its byte-by-byte loop and
+   mysql_real_escape_string(); needs no server */
+
+#include <stdbool.h>
+#include <string.h>
+#include <mysql.h>
+
+#include "bench.h"
+#include "../cqstatic.h"
+
+#define RUNS 5
+
+size_t cq_escape_scalar(char *dst, const char *src, size_t len, bool *isnum);
+
+/* values of mixed length, one in sixteen holding a character to escape */
+static char *make_values(size_t n, size_t *lens, size_t *total)
+{
+    static const char text[] = "The quick brown fox jumps over the lazy dog "
+            "while 0123456789 counts along; ";
+
+    *total = 0;
+    for (size_t i = 0; i < n; ++i) {
+        lens[i] = 4 + i * 7 % 60;
+        *total += lens[i];
+    }
+
+    char *buf = malloc(*total);
+    if (buf == NULL)
+        return NULL;
+
+    char *p = buf;
+    for (size_t i = 0; i < n; ++i) {
+        for (size_t j = 0; j < lens[i]; ++j)
+            p[j] = text[(i + j) % (sizeof text - 1)];
+        if (i % 16 == 0)
+            p[lens[i] / 2] = '\'';
+        p += lens[i];
+    }
+
+    return buf;
+}
+
+typedef size_t (*escape_fn)(void *mysql, char *dst, const char *src,
+        size_t len);
+
+static size_t run_vector(void *mysql, char *dst, const char *src, size_t len)
+{
+    (void) mysql;
+    return cq_escape(dst, src, len, NULL);
+}
+
+static size_t run_scalar(void *mysql, char *dst, const char *src, size_t len)
+{
+    (void) mysql;
+    return cq_escape_scalar(dst, src, len, NULL);
+}
+
+static size_t run_client(void *mysql, char *dst, const char *src, size_t len)
+{
+    return mysql_real_escape_string(mysql, dst, src, len);
+}
+
+static double best(escape_fn fn, void *mysql, char *dst, const char *values,
+        const size_t *lens, size_t n, size_t *out)
+{
+    double min = 0;
+
+    for (int run = 0; run < RUNS; ++run) {
+        const char *src = values;
+        size_t sum = 0;
+
+        double start = bench_now();
+        for (size_t i = 0; i < n; ++i) {
+            sum += fn(mysql, dst, src, lens[i]);
+            src += lens[i];
+        }
+        double t = bench_now() - start;
+
+        if (!run || t < min)
+            min = t;
+        *out = sum;
+    }
+
+    return min;
+}
+
+int main(int argc, char **argv)
+{
+    size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 10000000;
+    size_t total;
+
+    size_t *lens = malloc((n ? n : 1) * sizeof(size_t));
+    char *values = lens != NULL ? make_values(n, lens, &total) : NULL;
+    char *dst = malloc(64 * 2 + 1);
+    MYSQL *mysql = mysql_init(NULL);
+    if (values == NULL || dst == NULL || mysql == NULL) {
+        fprintf(stderr, "%s: out of memory\n", argv[0]);
+        return 1;
+    }
+
+    size_t vec, sca, cli;
+    bench_report("vector kernel", n, "values", best(run_vector, NULL, dst,
+            values, lens, n, &vec));
+    bench_report("scalar loop", n, "values", best(run_scalar, NULL, dst,
+            values, lens, n, &sca));
+    bench_report("client library", n, "values", best(run_client, mysql, dst,
+            values, lens, n, &cli));
+    printf("%zu bytes in, %zu bytes out\n", total, vec);
+
+    mysql_close(mysql);
+    free(dst);
+    free(values);
+    free(lens);
+
+    /* all three must agree on the output */
+    return vec != sca || vec != cli;
+}
@@ -0,0 +1,24 @@
+/*
+ *  cquel - MySQL C API wrapper with dynamic data structures
+ *  Copyright (C) 2014 Delwink, LLC
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as published by
+ *  the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* the escape kernel again without vectors, under names of its own */
+
+#define CQ_NO_SIMD
+#define cq_escape cq_escape_scalar
+#define cq_plain_escapes cq_plain_escapes_scalar
+
+#include "../cqescape.c"
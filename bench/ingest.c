@@ -0,0 +1,110 @@
+/*
+ *  cquel - MySQL C API wrapper with dynamic data structures
+ *  Copyright (C) 2014 Delwink, LLC
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as published by
+ *  the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* times cq_select_query(), whose rows adopt the result's buffers, against
+   copying every value into a row of its own as it did before */
+
+#include "bench.h"
+
+#define RUNS 5
+
+struct copy {
+    struct dlist *list;
+    int rc;
+};
+
+static int copy_row(const struct dlist *list, struct drow *row, void *data)
+{
+    struct copy *c = data;
+
+    if (c->list == NULL) {
+        c->list = cq_new_dlist(list->fieldc, list->fieldnames, list->primkey);
+        if (c->list == NULL) {
+            c->rc = -1;
+            return 1;
+        }
+    }
+
+    struct drow *r = cq_new_drow(row->fieldc);
+    if (r == NULL) {
+        c->rc = -2;
+        return 1;
+    }
+
+    for (size_t i = 0; i < row->fieldc; ++i) {
+        if (cq_drow_set_value(r, i, row->values[i], row->lengths[i])) {
+            cq_free_drow(r);
+            c->rc = -3;
+            return 1;
+        }
+    }
+
+    cq_dlist_add(c->list, r);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    struct dbconn con;
+    size_t rows = 1000000;
+
+    int rc = bench_connect(argc, argv, &con, &rows);
+    if (rc)
+        return rc;
+
+    struct dlist *list = bench_rows(rows);
+    if (list == NULL || bench_table(con) || cq_insert(con, BENCH_TABLE,
+                list)) {
+        fprintf(stderr, "%s: could not fill " BENCH_TABLE "\n", argv[0]);
+        cq_free_dlist(list);
+        cq_close_connection(&con);
+        return 3;
+    }
+    cq_free_dlist(list);
+
+    double adopt = 0, copy = 0;
+    for (int run = 0; run < RUNS && !rc; ++run) {
+        struct dlist *out = NULL;
+        double start = bench_now();
+        rc = cq_select_query(con, &out, "* FROM " BENCH_TABLE);
+        double t = bench_now() - start;
+        cq_free_dlist(out);
+        if (!run || t < adopt)
+            adopt = t;
+
+        struct copy c = { NULL, 0 };
+        start = bench_now();
+        if (!rc)
+            rc = cq_select_each(con, "* FROM " BENCH_TABLE, copy_row, &c);
+        t = bench_now() - start;
+        cq_free_dlist(c.list);
+        if (!rc)
+            rc = c.rc;
+        if (!run || t < copy)
+            copy = t;
+    }
+
+    if (rc) {
+        fprintf(stderr, "%s: select failed with %d\n", argv[0], rc);
+    } else {
+        bench_report("adopted buffers", rows, "rows", adopt);
+        bench_report("copied values", rows, "rows", copy);
+    }
+
+    cq_close_connection(&con);
+    return rc ? 4 : 0;
+}
@@ -0,0 +1,67 @@
+/*
+ *  cquel - MySQL C API wrapper with dynamic data structures
+ *  Copyright (C) 2014 Delwink, LLC
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as published by
+ *  the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* times cq_load_dlist() against cq_insert() on the same rows; the server
+   must allow local_infile */
+
+#include "bench.h"
+
+typedef int (*insert_fn)(struct dbconn con, const char *table,
+        const struct dlist *list);
+
+static int timed(const char *what, insert_fn fn, struct dbconn con,
+        const struct dlist *list, size_t rows)
+{
+    int rc = bench_table(con);
+    if (rc)
+        return rc;
+
+    double start = bench_now();
+    rc = fn(con, BENCH_TABLE, list);
+    double t = bench_now() - start;
+
+    if (rc)
+        fprintf(stderr, "%s failed with %d\n", what, rc);
+    else
+        bench_report(what, rows, "rows", t);
+    return rc;
+}
+
+int main(int argc, char **argv)
+{
+    struct dbconn con;
+    size_t rows = 1000000;
+
+    int rc = bench_connect(argc, argv, &con, &rows);
+    if (rc)
+        return rc;
+
+    struct dlist *list = bench_rows(rows);
+    if (list == NULL) {
+        fprintf(stderr, "%s: out of memory\n", argv[0]);
+        cq_close_connection(&con);
+        return 3;
+    }
+
+    rc = timed("cq_insert", cq_insert, con, list, rows);
+    if (!rc)
+        rc = timed("cq_load_dlist", cq_load_dlist, con, list, rows);
+
+    cq_free_dlist(list);
+    cq_close_connection(&con);
+    return rc ? 4 : 0;
+}
@@ -0,0 +1,214 @@
+/*
+ *  cquel - MySQL C API wrapper with dynamic data structures
+ *  Copyright (C) 2014 Delwink, LLC
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as published by
+ *  the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* runs inserts and selects from many threads through one pool while they all
+   read a shared list, then checks that nothing was lost and no query failed;
+   half the threads have a context of their own and half share the default */
+
+#include <pthread.h>
+#include <string.h>
+
+#include "bench.h"
+
+#define STRESS_THREADS 8
+#define STRESS_ITERS 500
+
+struct worker {
+    pthread_t thread;
+    struct dbconn con;
+    const struct dlist *shared;
+    size_t first;
+    size_t failures;
+};
+
+/* the first row of the shared list was removed, so row i has id i + 2 */
+static bool read_shared(const struct dlist *shared, size_t i)
+{
+    long long id;
+    const struct drow *row = cq_dlist_at(shared, i);
+
+    return row != NULL && !cq_drow_get_int(row, 0, &id)
+            && id == (long long) i + 2;
+}
+
+static bool insert_one(struct worker *w, struct dlist *one, size_t id)
+{
+    char idstr[24];
+    char * const values[] = { idstr, "stress", "it's a row", "1.5" };
+
+    snprintf(idstr, sizeof idstr, "%zu", id);
+    return !cq_drow_set(one->first, values)
+            && !cq_insert(w->con, BENCH_TABLE, one);
+}
+
+static bool select_one(struct worker *w, size_t id)
+{
+    char query[64], idstr[24];
+    struct dlist *out;
+
+    snprintf(query, sizeof query, "SELECT id FROM " BENCH_TABLE
+            " WHERE id = %zu", id);
+    if (cq_select_query(w->con, &out, query))
+        return false;
+
+    snprintf(idstr, sizeof idstr, "%zu", id);
+    bool ok = cq_dlist_size(out) == 1
+            && !strcmp(cq_dlist_at(out, 0)->values[0], idstr);
+    cq_free_dlist(out);
+    return ok;
+}
+
+static void *work(void *data)
+{
+    static char * const fields[] = { "id", "name", "note", "score" };
+    struct worker *w = data;
+    size_t n = cq_dlist_size(w->shared);
+
+    struct dlist *one = cq_new_dlist(4, fields, "id");
+    struct drow *row = cq_dlist_new_drow(one);
+    if (row == NULL) {
+        cq_free_dlist(one);
+        w->failures = STRESS_ITERS;
+        return NULL;
+    }
+    cq_dlist_add(one, row);
+
+    size_t seed = w->first;
+    for (size_t i = 0; i < STRESS_ITERS; ++i) {
+        seed = seed * 6364136223846793005u + 1442695040888963407u;
+        if (!read_shared(w->shared, (seed >> 16) % n))
+            ++w->failures;
+
+        size_t id = w->first + i;
+        if (!insert_one(w, one, id) || !select_one(w, id))
+            ++w->failures;
+    }
+
+    cq_free_dlist(one);
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    struct dbconn con;
+    size_t rows = 10000;
+    struct worker workers[STRESS_THREADS];
+    struct cq_ctx *ctxs[STRESS_THREADS] = { NULL };
+
+    int rc = bench_connect(argc, argv, &con, &rows);
+    if (rc)
+        return rc;
+    if (rows < 2)
+        rows = 2;
+
+    struct dlist *shared = bench_rows(rows);
+    struct cq_pool *pool = cq_new_pool(con, STRESS_THREADS, 0);
+    if (shared == NULL || pool == NULL) {
+        fprintf(stderr, "%s: out of memory\n", argv[0]);
+        cq_free_pool(pool);
+        cq_free_dlist(shared);
+        cq_close_connection(&con);
+        return 3;
+    }
+
+    rc = bench_table(con);
+    if (!rc)
+        rc = cq_insert(con, BENCH_TABLE, shared);
+    if (rc) {
+        fprintf(stderr, "%s: setup failed with %d\n", argv[0], rc);
+        cq_free_pool(pool);
+        cq_free_dlist(shared);
+        cq_close_connection(&con);
+        return 4;
+    }
+
+    /* leave the row index stale, so that the threads read it by walking */
+    cq_dlist_remove(shared, shared->first);
+
+    size_t started = 0;
+    double start = bench_now();
+    for (size_t t = 0; t < STRESS_THREADS; ++t) {
+        struct worker *w = &workers[t];
+
+        if (t % 2)
+            ctxs[t] = cq_new_ctx(1 << 20, 64);
+
+        w->con = cq_new_connection(con.host, con.user, con.passwd,
+                con.database);
+        w->con.pool = pool;
+        w->con.ctx = ctxs[t];
+        w->shared = shared;
+        w->first = rows + 1 + t * STRESS_ITERS;
+        w->failures = 0;
+
+        if ((t % 2 && ctxs[t] == NULL)
+                || pthread_create(&w->thread, NULL, work, w))
+            break;
+        ++started;
+    }
+
+    size_t failures = 0;
+    for (size_t t = 0; t < started; ++t) {
+        pthread_join(workers[t].thread, NULL);
+        failures += workers[t].failures;
+    }
+    double secs = bench_now() - start;
+    bench_report("mixed operations", started * STRESS_ITERS * 3, "ops",
+            secs);
+
+    if (started < STRESS_THREADS) {
+        fprintf(stderr, "only %zu threads started\n", started);
+        ++failures;
+    }
+
+    struct dlist *count;
+    char expect[24];
+    snprintf(expect, sizeof expect, "%zu", rows + started * STRESS_ITERS);
+    if (cq_select_query(con, &count, "SELECT COUNT(*) FROM " BENCH_TABLE)) {
+        fprintf(stderr, "could not count the rows\n");
+        ++failures;
+    } else {
+        if (strcmp(count->first->values[0], expect)) {
+            fprintf(stderr, "%s rows, expected %s\n", count->first->values[0],
+                    expect);
+            ++failures;
+        }
+        cq_free_dlist(count);
+    }
+
+    /* each thread runs two queries per iteration, on its own context or on
+       the default one */
+    for (size_t t = 1; t < started; t += 2) {
+        struct cq_stats stats;
+        cq_ctx_stats(ctxs[t], &stats);
+        if (stats.errors || stats.queries < 2 * STRESS_ITERS) {
+            fprintf(stderr, "thread %zu: %llu queries, %llu failed\n", t,
+                    stats.queries, stats.errors);
+            ++failures;
+        }
+    }
+
+    for (size_t t = 0; t < STRESS_THREADS; ++t)
+        cq_free_ctx(ctxs[t]);
+    cq_free_pool(pool);
+    cq_free_dlist(shared);
+    cq_close_connection(&con);
+
+    if (failures)
+        fprintf(stderr, "%zu failures\n", failures);
+    return failures ? 5 : 0;
+}
@@ -0,0 +1,104 @@
+/*
+ *  cquel - MySQL C API wrapper with dynamic data structures
+ *  Copyright (C) 2014 Delwink, LLC
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as published by
+ *  the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "cquel.h"
+#include "cqstatic.h"
+
+/* the usual size of a chunk; larger requests get a chunk of their own */
+#define CQ_ARENA_CHUNK (64 * 1024)
+
+struct chunk {
+    struct chunk *next;
+    size_t used;
+    size_t cap;
+    max_align_t data[];
+};
+
+struct cq_arena {
+    struct chunk *chunks;
+};
+
+struct cq_arena *cq_new_arena(void)
+{
+    return calloc(1, sizeof(struct cq_arena));
+}
+
+void cq_free_arena(struct cq_arena *arena)
+{
+    if (arena == NULL)
+        return;
+
+    struct chunk *c = arena->chunks;
+    while (c != NULL) {
+        struct chunk *next = c->next;
+        free(c);
+        c = next;
+    }
+
+    free(arena);
+}
+
+void *cq_arena_alloc(struct cq_arena *arena, size_t size)
+{
+    const size_t align = _Alignof(max_align_t);
+    struct chunk *c = arena->chunks;
+
+    size = (size + align - 1) / align * align;
+    if (size == 0)
+        size = align;
+
+    if (c == NULL || c->cap - c->used < size) {
+        size_t cap = size > CQ_ARENA_CHUNK ? size : CQ_ARENA_CHUNK;
+
+        c = malloc(sizeof(struct chunk) + cap);
+        if (c == NULL)
+            return NULL;
+
+        c->used = 0;
+        c->cap = cap;
+
+        /* keep filling the current chunk after an oversized request */
+        if (cap > CQ_ARENA_CHUNK && arena->chunks != NULL) {
+            c->next = arena->chunks->next;
+            arena->chunks->next = c;
+        } else {
+            c->next = arena->chunks;
+            arena->chunks = c;
+        }
+    }
+
+    void *p = (char *) c->data + c->used;
+    c->used += size;
+    return p;
+}
+
+void *cq_arena_calloc(struct cq_arena *arena, size_t nmemb, size_t size)
+{
+    if (size && nmemb > (size_t) -1 / size)
+        return NULL;
+
+    void *p = cq_arena_alloc(arena, nmemb * size);
+    if (p != NULL)
+        memset(p, 0, nmemb * size);
+
+    return p;
+}
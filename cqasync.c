@@ -0,0 +1,373 @@
+/*
+ *  cquel - MySQL C API wrapper with dynamic data structures
+ *  Copyright (C) 2014 Delwink, LLC
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as published by
+ *  the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <mysql.h>
+
+#include "cquel.h"
+#include "cqstatic.h"
+
+/* without the non-blocking calls of the MariaDB client, each step runs to
+   completion as soon as it is started */
+#ifndef MARIADB_BASE_VERSION
+#define mysql_real_query_start(err, m, q, len) \
+    (*(err) = mysql_real_query((m), (q), (len)), 0)
+#define mysql_store_result_start(res, m) (*(res) = mysql_store_result(m), 0)
+#define mysql_next_result_start(err, m) (*(err) = mysql_next_result(m), 0)
+#define mysql_real_query_cont(err, m, ready) 0
+#define mysql_store_result_cont(res, m, ready) 0
+#define mysql_next_result_cont(err, m, ready) 0
+#define mysql_get_timeout_value_ms(m) 0
+#endif
+
+enum state {
+    ASYNC_QUERY,
+    ASYNC_STORE,
+    ASYNC_NEXT,
+    ASYNC_DONE
+};
+
+struct cq_async {
+    struct dbconn con;
+    bool owned;
+    char *query;
+    size_t len;
+
+    enum state state;
+    int status;
+    int err;
+    MYSQL_RES *res;
+
+    int rc;
+    MYSQL_RES *result;
+    struct dlist *list;
+    unsigned long long affected;
+
+    cq_async_fn done;
+    void *data;
+};
+
+static void finish(struct cq_async *q, int rc)
+{
+    q->state = ASYNC_DONE;
+
+    /* the first result set becomes the list; any others were discarded */
+    if (q->result != NULL) {
+        if (!rc)
+            rc = cq_result_to_dlist(&q->con, q->result, false, &q->list);
+        else
+            mysql_free_result(q->result);
+        q->result = NULL;
+    }
+
+    q->rc = rc;
+    cq_count_query(&q->con, rc);
+
+    /* this runs in the caller's event loop, which must not wait on a reset */
+    if (q->owned && q->con.pool != NULL)
+        cq_pool_checkin_unreset(q->con.pool, &q->con);
+    else
+        cq_release(&q->con, q->owned);
+
+    if (q->done != NULL)
+        q->done(q, q->data);
+}
+
+static int next_result(struct cq_async *q)
+{
+    if (!mysql_more_results(q->con.con)) {
+        finish(q, 0);
+        return 0;
+    }
+
+    q->state = ASYNC_NEXT;
+    return mysql_next_result_start(&q->err, q->con.con);
+}
+
+/* moves through the states until the client must wait on the socket */
+static void step(struct cq_async *q, int status)
+{
+    MYSQL *mysql = q->con.con;
+
+    while (!status && q->state != ASYNC_DONE) {
+        switch (q->state) {
+        case ASYNC_QUERY:
+        case ASYNC_NEXT:
+            if (q->err) {
+                finish(q, 201);
+            } else if (mysql_field_count(mysql)) {
+                q->state = ASYNC_STORE;
+                status = mysql_store_result_start(&q->res, mysql);
+            } else {
+                q->affected = mysql_affected_rows(mysql);
+                status = next_result(q);
+            }
+            break;
+
+        case ASYNC_STORE:
+            if (q->res == NULL) {
+                finish(q, 202);
+                break;
+            }
+
+            if (q->result == NULL)
+                q->result = q->res;
+            else
+                mysql_free_result(q->res);
+            q->res = NULL;
+
+            status = next_result(q);
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    q->status = q->state == ASYNC_DONE ? 0 : status;
+}
+
+int cq_async_query(struct dbconn con, const char *query, cq_async_fn done,
+        void *data, struct cq_async **out)
+{
+    if (query == NULL)
+        return 1;
+    if (out == NULL)
+        return 2;
+
+    struct cq_async *q = calloc(1, sizeof(struct cq_async));
+    if (q == NULL)
+        return -1;
+
+    q->len = strlen(query);
+    q->query = malloc(q->len + 1);
+    if (q->query == NULL) {
+        free(q);
+        return -2;
+    }
+    memcpy(q->query, query, q->len + 1);
+
+    q->con = con;
+    if (cq_acquire(&q->con, &q->owned)) {
+        free(q->query);
+        free(q);
+        return 200;
+    }
+
+    q->done = done;
+    q->data = data;
+    q->state = ASYNC_QUERY;
+    *out = q;
+
+    step(q, mysql_real_query_start(&q->err, q->con.con, q->query, q->len));
+    return 0;
+}
+
+int cq_async_resume(struct cq_async *q, int ready)
+{
+    if (q == NULL)
+        return 0;
+
+    MYSQL *mysql = q->con.con;
+    int status;
+
+    (void) mysql;
+    (void) ready;
+
+    switch (q->state) {
+    case ASYNC_QUERY:
+        status = mysql_real_query_cont(&q->err, mysql, ready);
+        break;
+
+    case ASYNC_STORE:
+        status = mysql_store_result_cont(&q->res, mysql, ready);
+        break;
+
+    case ASYNC_NEXT:
+        status = mysql_next_result_cont(&q->err, mysql, ready);
+        break;
+
+    default:
+        return 0;
+    }
+
+    step(q, status);
+    return q->status;
+}
+
+int cq_async_fd(const struct cq_async *q)
+{
+    if (q == NULL || q->state == ASYNC_DONE)
+        return -1;
+
+    return mysql_get_socket(q->con.con);
+}
+
+int cq_async_events(const struct cq_async *q)
+{
+    return q == NULL ? 0 : q->status;
+}
+
+unsigned int cq_async_timeout(const struct cq_async *q)
+{
+    if (q == NULL || !(q->status & CQ_WAIT_TIMEOUT))
+        return 0;
+
+    return mysql_get_timeout_value_ms(q->con.con);
+}
+
+bool cq_async_done(const struct cq_async *q)
+{
+    return q == NULL || q->state == ASYNC_DONE;
+}
+
+int cq_async_result(struct cq_async *q, struct dlist **out)
+{
+    if (q == NULL)
+        return 1;
+    if (q->state != ASYNC_DONE)
+        return 2;
+
+    if (out != NULL) {
+        *out = q->list;
+        q->list = NULL;
+    }
+
+    return q->rc;
+}
+
+unsigned long long cq_async_affected(const struct cq_async *q)
+{
+    return q == NULL ? 0 : q->affected;
+}
+
+static short poll_events(int status)
+{
+    short events = 0;
+
+    if (status & CQ_WAIT_READ)
+        events |= POLLIN;
+    if (status & CQ_WAIT_WRITE)
+        events |= POLLOUT;
+    if (status & CQ_WAIT_EXCEPT)
+        events |= POLLPRI;
+
+    return events;
+}
+
+static int ready_events(short revents)
+{
+    int ready = 0;
+
+    /* errors and hangups are read so that the client sees them */
+    if (revents & (POLLIN | POLLERR | POLLHUP))
+        ready |= CQ_WAIT_READ;
+    if (revents & POLLOUT)
+        ready |= CQ_WAIT_WRITE;
+    if (revents & POLLPRI)
+        ready |= CQ_WAIT_EXCEPT;
+
+    return ready;
+}
+
+int cq_async_poll(struct cq_async * const *qs, size_t n, int timeout)
+{
+    struct pollfd *fds = calloc(n ? n : 1, sizeof(struct pollfd));
+    if (fds == NULL)
+        return -1;
+
+    size_t pending = 0;
+    for (size_t i = 0; i < n; ++i) {
+        fds[i].fd = -1;
+        if (cq_async_done(qs[i]))
+            continue;
+
+        fds[i].fd = cq_async_fd(qs[i]);
+        fds[i].events = poll_events(qs[i]->status);
+        ++pending;
+
+        /* wake for the earliest client timeout */
+        if (qs[i]->status & CQ_WAIT_TIMEOUT) {
+            int ms = (int) cq_async_timeout(qs[i]);
+            if (timeout < 0 || ms < timeout)
+                timeout = ms;
+        }
+    }
+
+    if (!pending) {
+        free(fds);
+        return 0;
+    }
+
+    int rc = poll(fds, n, timeout);
+    if (rc < 0) {
+        free(fds);
+        return -1;
+    }
+
+    pending = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (cq_async_done(qs[i]))
+            continue;
+
+        int ready = ready_events(fds[i].revents);
+        if (!ready && rc == 0 && (qs[i]->status & CQ_WAIT_TIMEOUT))
+            ready = CQ_WAIT_TIMEOUT;
+
+        if (ready)
+            cq_async_resume(qs[i], ready);
+        if (!cq_async_done(qs[i]))
+            ++pending;
+    }
+
+    free(fds);
+    return (int) pending;
+}
+
+void cq_free_async(struct cq_async *q)
+{
+    if (q == NULL)
+        return;
+
+    /* an unfinished query is run out, so that its connection is left ready
+       for the next one */
+    q->done = NULL;
+    while (!cq_async_done(q)
+            && (cq_async_poll(&q, 1, -1) >= 0 || errno == EINTR))
+        ;
+
+    /* if waiting failed, a leased connection is out of step and cannot be
+       reused */
+    if (q->state != ASYNC_DONE) {
+        if (q->res != NULL)
+            mysql_free_result(q->res);
+        if (q->result != NULL)
+            mysql_free_result(q->result);
+
+        if (q->owned && q->con.pool != NULL)
+            cq_close_connection(&q->con);
+        cq_release(&q->con, q->owned);
+    }
+
+    cq_free_dlist(q->list);
+    free(q->query);
+    free(q);
+}
@@ -0,0 +1,172 @@
+/*
+ *  cquel - MySQL C API wrapper with dynamic data structures
+ *  Copyright (C) 2014 Delwink, LLC
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as published by
+ *  the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <mysql.h>
+
+#include "cquel.h"
+#include "cqstatic.h"
+
+/* the first allocation of a builder; it doubles from there */
+#define CQ_BUF_MIN 256
+
+void cq_buf_init(struct cq_buf *buf)
+{
+    buf->data = NULL;
+    buf->len = 0;
+    buf->cap = 0;
+    buf->escon = NULL;
+    buf->plain = false;
+}
+
+void cq_buf_free(struct cq_buf *buf)
+{
+    free(buf->data);
+    cq_buf_init(buf);
+}
+
+void cq_buf_truncate(struct cq_buf *buf, size_t len)
+{
+    if (len < buf->len) {
+        buf->len = len;
+        buf->data[len] = '\0';
+    }
+}
+
+void cq_buf_reset(struct cq_buf *buf)
+{
+    cq_buf_truncate(buf, 0);
+}
+
+bool cq_buf_reserve(struct cq_buf *buf, size_t extra)
+{
+    if (buf->len + extra < buf->cap)
+        return true;
+
+    size_t cap = buf->cap ? buf->cap : CQ_BUF_MIN;
+    while (cap <= buf->len + extra) {
+        if (cap > (size_t) -1 / 2)
+            return false;
+        cap *= 2;
+    }
+
+    char *data = realloc(buf->data, cap);
+    if (data == NULL)
+        return false;
+
+    buf->data = data;
+    buf->cap = cap;
+    return true;
+}
+
+bool cq_buf_append(struct cq_buf *buf, const char *s, size_t n)
+{
+    if (!cq_buf_reserve(buf, n))
+        return false;
+
+    memcpy(buf->data + buf->len, s, n);
+    buf->len += n;
+    buf->data[buf->len] = '\0';
+    return true;
+}
+
+bool cq_buf_puts(struct cq_buf *buf, const char *s)
+{
+    return cq_buf_append(buf, s, strlen(s));
+}
+
+bool cq_buf_printf(struct cq_buf *buf, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    int n = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+
+    if (n < 0 || !cq_buf_reserve(buf, n))
+        return false;
+
+    va_start(ap, fmt);
+    vsnprintf(buf->data + buf->len, buf->cap - buf->len, fmt, ap);
+    va_end(ap);
+
+    buf->len += n;
+    return true;
+}
+
+static bool buf_escaped(struct cq_buf *buf, struct dbconn *con,
+        const char *value, size_t len, bool usequotes, bool sniff)
+{
+    /* values prefixed with '\\' are SQL to be inlined as they are */
+    if (len && value[0] == '\\')
+        return cq_buf_append(buf, value + 1, len - 1);
+
+    if (!cq_buf_reserve(buf, len*2 + 2))
+        return false;
+
+    /* escape one character in, leaving room for an opening quote */
+    char *p = buf->data + buf->len;
+    size_t n;
+    bool isnum;
+
+    /* the connection's escaping rules cannot change while a query is built */
+    if (buf->escon != con->con) {
+        buf->escon = con->con;
+        buf->plain = cq_plain_escapes(con);
+    }
+
+    if (buf->plain) {
+        n = cq_escape(p + 1, value, len, &isnum);
+    } else {
+        n = mysql_real_escape_string(con->con, p + 1, value, len);
+
+        isnum = n > 0;
+        for (size_t j = 0; isnum && j < n; ++j)
+            isnum = isdigit((unsigned char) p[j + 1]);
+    }
+
+    bool isstr = usequotes && !(sniff && isnum);
+
+    if (isstr) {
+        p[0] = '\'';
+        p[n + 1] = '\'';
+        buf->len += n + 2;
+    } else {
+        memmove(p, p + 1, n);
+        buf->len += n;
+    }
+
+    buf->data[buf->len] = '\0';
+    return true;
+}
+
+bool cq_buf_value(struct cq_buf *buf, struct dbconn *con, const char *value,
+        size_t len, bool usequotes)
+{
+    return buf_escaped(buf, con, value, len, usequotes, true);
+}
+
+bool cq_buf_string(struct cq_buf *buf, struct dbconn *con, const char *value,
+        size_t len)
+{
+    return buf_escaped(buf, con, value, len, true, false);
+}
@@ -0,0 +1,329 @@
+/*
+ *  cquel - MySQL C API wrapper with dynamic data structures
+ *  Copyright (C) 2014 Delwink, LLC
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as published by
+ *  the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <mysql.h>
+
+#include "cquel.h"
+#include "cqstatic.h"
+
+#define CQ_COLS_ROWS 64
+#define CQ_COLS_DATA 1024
+
+static struct dcols *new_dcols(size_t fieldc, const MYSQL_FIELD *fields)
+{
+    struct dcols *cols = calloc(1, sizeof(struct dcols));
+    if (cols == NULL)
+        return NULL;
+
+    cols->columns = calloc(fieldc, sizeof(struct dcolumn));
+    if (cols->columns == NULL) {
+        free(cols);
+        return NULL;
+    }
+    cols->fieldc = fieldc;
+
+    for (size_t i = 0; i < fieldc; ++i) {
+        struct dcolumn *c = &cols->columns[i];
+        size_t len = strlen(fields[i].name);
+
+        c->name = malloc(len + 1);
+        c->offsets = malloc((CQ_COLS_ROWS + 1) * sizeof(size_t));
+        c->nulls = calloc(CQ_COLS_ROWS / 8, sizeof(unsigned char));
+        c->data = malloc(CQ_COLS_DATA);
+        if (c->name == NULL || c->offsets == NULL || c->nulls == NULL
+                || c->data == NULL) {
+            cq_free_dcols(cols);
+            return NULL;
+        }
+
+        memcpy(c->name, fields[i].name, len + 1);
+        c->offsets[0] = 0;
+        c->datacap = CQ_COLS_DATA;
+    }
+
+    cols->rowcap = CQ_COLS_ROWS;
+    return cols;
+}
+
+static int grow_rows(struct dcols *cols)
+{
+    size_t cap = cols->rowcap * 2;
+
+    for (size_t i = 0; i < cols->fieldc; ++i) {
+        struct dcolumn *c = &cols->columns[i];
+
+        size_t *offsets = realloc(c->offsets, (cap + 1) * sizeof(size_t));
+        if (offsets == NULL)
+            return -1;
+        c->offsets = offsets;
+
+        unsigned char *nulls = realloc(c->nulls, cap / 8);
+        if (nulls == NULL)
+            return -1;
+        memset(nulls + cols->rowcap / 8, 0, (cap - cols->rowcap) / 8);
+        c->nulls = nulls;
+    }
+
+    cols->rowcap = cap;
+    return 0;
+}
+
+static int append_value(struct dcolumn *c, size_t row, const char *value,
+        size_t len)
+{
+    size_t used = c->offsets[row];
+
+    if (value == NULL) {
+        c->nulls[row / 8] |= 1 << (row % 8);
+        len = 0;
+    }
+
+    /* values are followed by a null byte for use as strings */
+    if (used + len + 1 > c->datacap) {
+        size_t cap = c->datacap * 2;
+        while (used + len + 1 > cap)
+            cap *= 2;
+
+        char *data = realloc(c->data, cap);
+        if (data == NULL)
+            return -1;
+
+        c->data = data;
+        c->datacap = cap;
+    }
+
+    if (len)
+        memcpy(c->data + used, value, len);
+    c->data[used + len] = '\0';
+    c->offsets[row + 1] = used + len + 1;
+    return 0;
+}
+
+int cq_select_columns(struct dbconn con, struct dcols **out, const char *q)
+{
+    int rc;
+    bool owned;
+    struct cq_buf query;
+
+    if (out == NULL)
+        return 1;
+    if (q == NULL)
+        return 2;
+
+    cq_buf_init(&query);
+    if (!cq_buf_printf(&query, "SELECT %s", q)) {
+        cq_buf_free(&query);
+        return -1;
+    }
+
+    rc = cq_acquire(&con, &owned);
+    if (rc) {
+        cq_buf_free(&query);
+        return 200;
+    }
+
+    rc = cq_query_buf(&con, &query);
+    cq_buf_free(&query);
+    if (rc) {
+        cq_release(&con, owned);
+        return 201;
+    }
+
+    /* rows go straight into the columns without being buffered first */
+    MYSQL_RES *result = mysql_use_result(con.con);
+    if (result == NULL) {
+        cq_release(&con, owned);
+        return 202;
+    }
+
+    *out = new_dcols(mysql_num_fields(result), mysql_fetch_fields(result));
+    if (*out == NULL) {
+        mysql_free_result(result);
+        cq_release(&con, owned);
+        return -2;
+    }
+
+    struct dcols *cols = *out;
+    MYSQL_ROW row;
+    while ((row = mysql_fetch_row(result))) {
+        unsigned long *lengths = mysql_fetch_lengths(result);
+
+        if (cols->rowc == cols->rowcap && grow_rows(cols)) {
+            rc = -3;
+            break;
+        }
+
+        for (size_t i = 0; i < cols->fieldc && !rc; ++i)
+            if (append_value(&cols->columns[i], cols->rowc, row[i],
+                    lengths[i]))
+                rc = -4;
+        if (rc)
+            break;
+
+        ++cols->rowc;
+    }
+
+    if (!rc && mysql_errno(con.con))
+        rc = 203;
+
+    mysql_free_result(result);
+    cq_release(&con, owned);
+
+    if (rc) {
+        cq_free_dcols(*out);
+        *out = NULL;
+    }
+
+    return rc;
+}
+
+void cq_free_dcols(struct dcols *cols)
+{
+    if (cols == NULL)
+        return;
+
+    for (size_t i = 0; i < cols->fieldc; ++i) {
+        free(cols->columns[i].name);
+        free(cols->columns[i].offsets);
+        free(cols->columns[i].nulls);
+        free(cols->columns[i].data);
+    }
+
+    free(cols->columns);
+    free(cols);
+}
+
+int cq_dcols_index(const struct dcols *cols, const char *name, size_t *out)
+{
+    if (cols == NULL)
+        return -1;
+    if (name == NULL)
+        return -2;
+    if (out == NULL)
+        return -3;
+
+    for (*out = 0; *out < cols->fieldc; ++(*out))
+        if (!strcmp(cols->columns[*out].name, name))
+            return 0;
+
+    return 1;
+}
+
+/* the scans check their indices once, rather than for every row */
+static bool is_null(const struct dcolumn *c, size_t row)
+{
+    return c->nulls[row / 8] & (1 << (row % 8));
+}
+
+bool cq_dcols_is_null(const struct dcols *cols, size_t col, size_t row)
+{
+    /* a value which is not there has no more value than NULL */
+    if (cols == NULL || col >= cols->fieldc || row >= cols->rowc)
+        return true;
+
+    return is_null(&cols->columns[col], row);
+}
+
+const char *cq_dcols_value(const struct dcols *cols, size_t col, size_t row,
+        size_t *len)
+{
+    if (cols == NULL || col >= cols->fieldc || row >= cols->rowc)
+        return NULL;
+
+    const struct dcolumn *c = &cols->columns[col];
+    if (is_null(c, row))
+        return NULL;
+
+    if (len != NULL)
+        *len = c->offsets[row + 1] - c->offsets[row] - 1;
+
+    return c->data + c->offsets[row];
+}
+
+int cq_dcols_scan(const struct dcols *cols, size_t col, cq_value_fn fn,
+        void *data)
+{
+    if (cols == NULL || col >= cols->fieldc)
+        return 1;
+    if (fn == NULL)
+        return 2;
+
+    const struct dcolumn *c = &cols->columns[col];
+    for (size_t i = 0; i < cols->rowc; ++i) {
+        const char *value = c->data + c->offsets[i];
+        size_t len = c->offsets[i + 1] - c->offsets[i] - 1;
+
+        if (is_null(c, i))
+            value = NULL;
+
+        if (fn(i, value, len, data))
+            break;
+    }
+
+    return 0;
+}
+
+size_t cq_dcols_filter(const struct dcols *cols, size_t col, cq_value_fn fn,
+        void *data, size_t *out)
+{
+    size_t n = 0;
+
+    if (cols == NULL || col >= cols->fieldc || fn == NULL || out == NULL)
+        return 0;
+
+    const struct dcolumn *c = &cols->columns[col];
+    for (size_t i = 0; i < cols->rowc; ++i) {
+        const char *value = c->data + c->offsets[i];
+        size_t len = c->offsets[i + 1] - c->offsets[i] - 1;
+
+        if (is_null(c, i))
+            value = NULL;
+
+        if (fn(i, value, len, data))
+            out[n++] = i;
+    }
+
+    return n;
+}
+
+int cq_dcols_sum(const struct dcols *cols, size_t col, double *out)
+{
+    if (cols == NULL || col >= cols->fieldc)
+        return 1;
+    if (out == NULL)
+        return 2;
+
+    const struct dcolumn *c = &cols->columns[col];
+    double sum = 0;
+    for (size_t i = 0; i < cols->rowc; ++i) {
+        if (is_null(c, i))
+            continue;
+
+        const char *value = c->data + c->offsets[i];
+        char *end;
+        sum += strtod(value, &end);
+        if (end == value || *end != '\0')
+            return 3;
+    }
+
+    *out = sum;
+    return 0;
+}
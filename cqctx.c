@@ -0,0 +1,186 @@
+/*
+ *  cquel - MySQL C API wrapper with dynamic data structures
+ *  Copyright (C) 2014 Delwink, LLC
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as published by
+ *  the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <mysql.h>
+
+#include "cquel.h"
+#include "cqstatic.h"
+
+/* seconds a table's metadata is trusted before it is looked up again */
+#define CQ_META_TTL 60
+
+/* room left in a packet for the protocol's own framing */
+#define CQ_PACKET_SLACK 1024
+
+/* the query length used if the server's packet limit cannot be read, within
+   the default of every server */
+#define CQ_QLEN_FALLBACK (1 << 20)
+
+/* used by connections without a context of their own; set by cq_init() */
+static struct cq_ctx default_ctx = {
+    .qlen = 0,
+    .fmaxlen = 0,
+    .meta_lock = PTHREAD_MUTEX_INITIALIZER,
+    .meta_head = NULL,
+    .meta_ttl = CQ_META_TTL,
+};
+
+static pthread_once_t library_once = PTHREAD_ONCE_INIT;
+static pthread_key_t thread_key;
+static bool library_ready = false;
+
+static void thread_end(void *unused)
+{
+    (void) unused;
+    mysql_thread_end();
+}
+
+static void library_init(void)
+{
+    library_ready = !mysql_library_init(0, NULL, NULL)
+            && !pthread_key_create(&thread_key, thread_end);
+}
+
+int cq_thread_init(void)
+{
+    pthread_once(&library_once, library_init);
+    if (!library_ready)
+        return 1;
+
+    if (pthread_getspecific(thread_key) != NULL)
+        return 0;
+
+    if (mysql_thread_init())
+        return 2;
+
+    /* any value but NULL has the key's destructor run when the thread exits */
+    if (pthread_setspecific(thread_key, &library_ready)) {
+        mysql_thread_end();
+        return 3;
+    }
+
+    return 0;
+}
+
+struct cq_ctx *cq_ctx_get(struct cq_ctx *ctx)
+{
+    return ctx != NULL ? ctx : &default_ctx;
+}
+
+struct cq_ctx *cq_new_ctx(size_t qlen, size_t fmaxlen)
+{
+    struct cq_ctx *ctx = calloc(1, sizeof(struct cq_ctx));
+    if (ctx == NULL)
+        return NULL;
+
+    if (pthread_mutex_init(&ctx->meta_lock, NULL)) {
+        free(ctx);
+        return NULL;
+    }
+
+    ctx->qlen = qlen;
+    ctx->fmaxlen = fmaxlen;
+    ctx->meta_head = NULL;
+    ctx->meta_ttl = CQ_META_TTL;
+    atomic_init(&ctx->packet, 0);
+    atomic_init(&ctx->queries, 0);
+    atomic_init(&ctx->errors, 0);
+    atomic_init(&ctx->connects, 0);
+    atomic_init(&ctx->meta_hits, 0);
+    atomic_init(&ctx->meta_misses, 0);
+
+    cq_thread_init();
+    return ctx;
+}
+
+void cq_free_ctx(struct cq_ctx *ctx)
+{
+    if (ctx == NULL || ctx == &default_ctx)
+        return;
+
+    cq_meta_clear(ctx);
+    pthread_mutex_destroy(&ctx->meta_lock);
+    free(ctx);
+}
+
+void cq_ctx_set_meta_ttl(struct cq_ctx *ctx, unsigned int seconds)
+{
+    ctx = cq_ctx_get(ctx);
+
+    pthread_mutex_lock(&ctx->meta_lock);
+    ctx->meta_ttl = seconds;
+    pthread_mutex_unlock(&ctx->meta_lock);
+}
+
+void cq_ctx_stats(struct cq_ctx *ctx, struct cq_stats *out)
+{
+    if (out == NULL)
+        return;
+
+    ctx = cq_ctx_get(ctx);
+    out->queries = atomic_load(&ctx->queries);
+    out->errors = atomic_load(&ctx->errors);
+    out->connects = atomic_load(&ctx->connects);
+    out->meta_hits = atomic_load(&ctx->meta_hits);
+    out->meta_misses = atomic_load(&ctx->meta_misses);
+}
+
+size_t cq_qlen(struct dbconn *con)
+{
+    struct cq_ctx *ctx = cq_ctx_get(con->ctx);
+    if (ctx->qlen)
+        return ctx->qlen;
+
+    size_t packet = atomic_load(&ctx->packet);
+    if (packet)
+        return packet;
+
+    /* a query length of 0 fills each statement up to the server's limit */
+    if (cq_query(con, "SELECT @@max_allowed_packet"))
+        return CQ_QLEN_FALLBACK;
+
+    MYSQL_RES *result = mysql_store_result(con->con);
+    if (result == NULL)
+        return CQ_QLEN_FALLBACK;
+
+    MYSQL_ROW row = mysql_fetch_row(result);
+    if (row != NULL && row[0] != NULL)
+        packet = strtoull(row[0], NULL, 10);
+    mysql_free_result(result);
+
+    if (packet <= 2 * CQ_PACKET_SLACK)
+        return CQ_QLEN_FALLBACK;
+
+    packet -= CQ_PACKET_SLACK;
+    atomic_store(&ctx->packet, packet);
+    return packet;
+}
+
+int cq_count_query(const struct dbconn *con, int rc)
+{
+    struct cq_ctx *ctx = cq_ctx_get(con->ctx);
+
+    atomic_fetch_add(&ctx->queries, 1);
+    if (rc)
+        atomic_fetch_add(&ctx->errors, 1);
+
+    return rc;
+}
@@ -0,0 +1,143 @@
+/*
+ *  cquel - MySQL C API wrapper with dynamic data structures
+ *  Copyright (C) 2014 Delwink, LLC
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as published by
+ *  the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <string.h>
+#include <mysql.h>
+
+/* CQ_NO_SIMD leaves only the byte-by-byte loop */
+#if defined(CQ_NO_SIMD)
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "cquel.h"
+#include "cqstatic.h"
+
+/* the vector width in bytes; blocks without special characters are copied
+   whole, and any block holding one is escaped byte by byte */
+#if defined(CQ_NO_SIMD)
+#elif defined(__AVX2__)
+#define LANES 32
+typedef __m256i vec;
+#define vload(p) _mm256_loadu_si256((const __m256i *) (p))
+#define vstore(p, v) _mm256_storeu_si256((__m256i *) (p), (v))
+#define vsplat _mm256_set1_epi8
+#define veq _mm256_cmpeq_epi8
+#define vgt _mm256_cmpgt_epi8
+#define vor _mm256_or_si256
+#define vmask _mm256_movemask_epi8
+#elif defined(__SSE2__)
+#define LANES 16
+typedef __m128i vec;
+#define vload(p) _mm_loadu_si128((const __m128i *) (p))
+#define vstore(p, v) _mm_storeu_si128((__m128i *) (p), (v))
+#define vsplat _mm_set1_epi8
+#define veq _mm_cmpeq_epi8
+#define vgt _mm_cmpgt_epi8
+#define vor _mm_or_si128
+#define vmask _mm_movemask_epi8
+#endif
+
+/* the same escapes mysql_real_escape_string() makes for single-byte and
+   UTF-8 character sets */
+static const char escapes[256] = {
+    [0] = '0',
+    ['\n'] = 'n',
+    ['\r'] = 'r',
+    ['\\'] = '\\',
+    ['\''] = '\'',
+    ['"'] = '"',
+    ['\032'] = 'Z',
+};
+
+static size_t escape_scalar(char *dst, const unsigned char *src, size_t len,
+        bool *digits)
+{
+    size_t n = 0;
+    bool d = *digits;
+
+    for (size_t i = 0; i < len; ++i) {
+        unsigned char c = src[i];
+        char e = escapes[c];
+
+        d = d && (unsigned char) (c - '0') < 10;
+        if (e) {
+            dst[n++] = '\\';
+            dst[n++] = e;
+        } else {
+            dst[n++] = c;
+        }
+    }
+
+    *digits = d;
+    return n;
+}
+
+size_t cq_escape(char *dst, const char *src, size_t len, bool *isnum)
+{
+    const unsigned char *s = (const unsigned char *) src;
+    size_t i = 0, n = 0;
+    bool digits = true;
+
+#ifdef LANES
+    const vec nul = vsplat(0), nl = vsplat('\n'), cr = vsplat('\r'),
+            bs = vsplat('\\'), sq = vsplat('\''), dq = vsplat('"'),
+            ctlz = vsplat('\032'), lo = vsplat('0'), hi = vsplat('9');
+
+    for (; i + LANES <= len; i += LANES) {
+        vec x = vload(s + i);
+        vec special = vor(vor(vor(veq(x, nul), veq(x, nl)),
+                vor(veq(x, cr), veq(x, bs))),
+                vor(vor(veq(x, sq), veq(x, dq)), veq(x, ctlz)));
+
+        /* bytes above 0x7f compare as negative and so below '0' */
+        if (digits)
+            digits = !vmask(vor(vgt(lo, x), vgt(x, hi)));
+
+        if (vmask(special)) {
+            n += escape_scalar(dst + n, s + i, LANES, &digits);
+        } else {
+            vstore(dst + n, x);
+            n += LANES;
+        }
+    }
+#endif
+
+    n += escape_scalar(dst + n, s + i, len - i, &digits);
+    dst[n] = '\0';
+
+    if (isnum != NULL)
+        *isnum = digits && len;
+    return n;
+}
+
+bool cq_plain_escapes(const struct dbconn *con)
+{
+    MYSQL *mysql = con->con;
+
+    /* in this mode quotes are doubled rather than escaped */
+    if (mysql->server_status & SERVER_STATUS_NO_BACKSLASH_ESCAPES)
+        return false;
+
+    /* multibyte sets other than UTF-8 may hide a '\\' in a character */
+    const char *cs = mysql_character_set_name(mysql);
+    return !strncmp(cs, "utf8", 4) || !strcmp(cs, "latin1")
+            || !strcmp(cs, "ascii") || !strcmp(cs, "binary");
+}
@@ -0,0 +1,222 @@
+/*
+ *  cquel - MySQL C API wrapper with dynamic data structures
+ *  Copyright (C) 2014 Delwink, LLC
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as published by
+ *  the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "cquel.h"
+#include "cqstatic.h"
+
+/* marks a slot whose row was removed, so that probing continues past it */
+static struct drow tombstone;
+
+struct slot {
+    struct drow *row;
+    size_t hash;
+};
+
+struct cq_keyindex {
+    size_t pindex;
+    size_t used;
+    size_t cap;
+    struct slot *slots;
+};
+
+static size_t hash_key(const char *key, size_t len)
+{
+    size_t h = 14695981039346656037ULL & (size_t) -1;
+
+    for (size_t i = 0; i < len; ++i) {
+        h ^= (unsigned char) key[i];
+        h *= (size_t) 1099511628211ULL;
+    }
+
+    return h;
+}
+
+static bool key_eq(const struct drow *row, size_t pindex, const char *key,
+        size_t len)
+{
+    return row->lengths[pindex] == len
+            && !memcmp(row->values[pindex], key, len);
+}
+
+static void place(struct cq_keyindex *keys, struct drow *row, size_t hash)
+{
+    size_t mask = keys->cap - 1;
+    size_t i = hash & mask;
+
+    while (keys->slots[i].row != NULL && keys->slots[i].row != &tombstone)
+        i = (i + 1) & mask;
+
+    keys->slots[i].row = row;
+    keys->slots[i].hash = hash;
+}
+
+static int grow(struct cq_keyindex *keys)
+{
+    struct slot *old = keys->slots;
+    size_t oldcap = keys->cap;
+    size_t cap = oldcap ? oldcap * 2 : 64;
+
+    keys->slots = calloc(cap, sizeof(struct slot));
+    if (keys->slots == NULL) {
+        keys->slots = old;
+        return -1;
+    }
+    keys->cap = cap;
+
+    /* rehashing drops the tombstones */
+    keys->used = 0;
+    for (size_t i = 0; i < oldcap; ++i) {
+        if (old[i].row != NULL && old[i].row != &tombstone) {
+            place(keys, old[i].row, old[i].hash);
+            ++keys->used;
+        }
+    }
+
+    free(old);
+    return 0;
+}
+
+struct cq_keyindex *cq_new_keyindex(size_t pindex)
+{
+    struct cq_keyindex *keys = calloc(1, sizeof(struct cq_keyindex));
+    if (keys == NULL)
+        return NULL;
+
+    keys->pindex = pindex;
+    if (grow(keys)) {
+        free(keys);
+        return NULL;
+    }
+
+    return keys;
+}
+
+void cq_free_keyindex(struct cq_keyindex *keys)
+{
+    if (keys == NULL)
+        return;
+
+    free(keys->slots);
+    free(keys);
+}
+
+size_t cq_keyindex_field(const struct cq_keyindex *keys)
+{
+    return keys->pindex;
+}
+
+void cq_keyindex_set_field(struct cq_keyindex *keys, size_t pindex)
+{
+    keys->pindex = pindex;
+}
+
+int cq_keyindex_add(struct cq_keyindex *keys, struct drow *row)
+{
+    /* tombstones count as used, keeping probe sequences short */
+    if ((keys->used + 1) * 2 > keys->cap && grow(keys))
+        return -1;
+
+    place(keys, row, hash_key(row->values[keys->pindex],
+            row->lengths[keys->pindex]));
+    ++keys->used;
+    return 0;
+}
+
+void cq_keyindex_remove(struct cq_keyindex *keys, const struct drow *row)
+{
+    size_t mask = keys->cap - 1;
+    size_t hash = hash_key(row->values[keys->pindex],
+            row->lengths[keys->pindex]);
+
+    for (size_t i = hash & mask; keys->slots[i].row != NULL;
+            i = (i + 1) & mask) {
+        if (keys->slots[i].row == row) {
+            keys->slots[i].row = &tombstone;
+            return;
+        }
+    }
+}
+
+int cq_fieldmap_build(struct dlist *list)
+{
+    size_t cap = 8;
+    while (cap < list->fieldc * 2)
+        cap *= 2;
+
+    free(list->fieldmap);
+    list->fieldmapcap = 0;
+
+    /* slots hold index + 1, leaving 0 for empty */
+    list->fieldmap = calloc(cap, sizeof(size_t));
+    if (list->fieldmap != NULL) {
+        list->fieldmapcap = cap;
+
+        for (size_t i = 0; i < list->fieldc; ++i) {
+            const char *name = list->fieldnames[i];
+            size_t j = hash_key(name, strlen(name)) & (cap - 1);
+
+            while (list->fieldmap[j])
+                j = (j + 1) & (cap - 1);
+            list->fieldmap[j] = i + 1;
+        }
+    }
+
+    if (cq_field_to_index(list, list->primkey, &list->pindex))
+        list->pindex = list->fieldc;
+
+    return list->fieldmap == NULL ? -1 : 0;
+}
+
+bool cq_fieldmap_find(const struct dlist *list, const char *name,
+        size_t *out)
+{
+    size_t mask = list->fieldmapcap - 1;
+
+    for (size_t j = hash_key(name, strlen(name)) & mask; list->fieldmap[j];
+            j = (j + 1) & mask) {
+        size_t i = list->fieldmap[j] - 1;
+
+        if (!strcmp(list->fieldnames[i], name)) {
+            *out = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+struct drow *cq_keyindex_find(const struct cq_keyindex *keys, const char *key,
+        size_t len)
+{
+    size_t mask = keys->cap - 1;
+    size_t hash = hash_key(key, len);
+
+    for (size_t i = hash & mask; keys->slots[i].row != NULL;
+            i = (i + 1) & mask) {
+        struct drow *row = keys->slots[i].row;
+
+        if (row != &tombstone && keys->slots[i].hash == hash
+                && key_eq(row, keys->pindex, key, len))
+            return row;
+    }
+
+    return NULL;
+}
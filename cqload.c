@@ -0,0 +1,206 @@
+/*
+ *  cquel - MySQL C API wrapper with dynamic data structures
+ *  Copyright (C) 2014 Delwink, LLC
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as published by
+ *  the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <mysql.h>
+#include <errmsg.h>
+
+#include "cquel.h"
+#include "cqstatic.h"
+
+/* the escapes LOAD DATA undoes with ESCAPED BY '\\'; a raw tab or newline
+   would otherwise end the field or the row */
+static const char tsv_escapes[256] = {
+    [0] = '0',
+    ['\t'] = 't',
+    ['\n'] = 'n',
+    ['\r'] = 'r',
+    ['\\'] = '\\',
+    ['\032'] = 'Z',
+};
+
+/* the rows being streamed to the server, one encoded row at a time */
+struct load {
+    const struct drow *row;
+    struct cq_buf pending;
+    size_t off;
+    int rc;
+};
+
+static bool tsv_value(struct cq_buf *buf, const char *value, size_t len)
+{
+    if (!cq_buf_reserve(buf, len * 2))
+        return false;
+
+    char *p = buf->data + buf->len;
+    for (size_t i = 0; i < len; ++i) {
+        unsigned char c = value[i];
+        char e = tsv_escapes[c];
+
+        if (e) {
+            *p++ = '\\';
+            *p++ = e;
+        } else {
+            *p++ = c;
+        }
+    }
+
+    buf->len = p - buf->data;
+    buf->data[buf->len] = '\0';
+    return true;
+}
+
+static bool tsv_row(struct cq_buf *buf, const struct drow *row)
+{
+    for (size_t i = 0; i < row->fieldc; ++i) {
+        if (i && !cq_buf_append(buf, "\t", 1))
+            return false;
+
+        if (cq_drow_is_null(row, i)) {
+            if (!cq_buf_append(buf, "\\N", 2))
+                return false;
+        } else if (!tsv_value(buf, row->values[i], row->lengths[i])) {
+            return false;
+        }
+    }
+
+    return cq_buf_append(buf, "\n", 1);
+}
+
+static int load_init(void **ptr, const char *filename, void *userdata)
+{
+    (void) filename;
+
+    /* outside cq_load_dlist() the server may not read anything */
+    *ptr = userdata;
+    return userdata == NULL;
+}
+
+static int load_read(void *ptr, char *buf, unsigned int len)
+{
+    struct load *l = ptr;
+    unsigned int n = 0;
+
+    while (n < len) {
+        if (l->off == l->pending.len) {
+            if (l->row == NULL)
+                break;
+
+            cq_buf_reset(&l->pending);
+            if (!tsv_row(&l->pending, l->row)) {
+                l->rc = -2;
+                return -1;
+            }
+
+            l->off = 0;
+            l->row = l->row->next;
+        }
+
+        size_t chunk = l->pending.len - l->off;
+        if (chunk > len - n)
+            chunk = len - n;
+
+        memcpy(buf + n, l->pending.data + l->off, chunk);
+        l->off += chunk;
+        n += chunk;
+    }
+
+    return n;
+}
+
+static void load_end(void *ptr)
+{
+    (void) ptr;
+}
+
+static int load_error(void *ptr, char *msg, unsigned int len)
+{
+    snprintf(msg, len, "%s", ptr == NULL ? "cquel refuses LOCAL INFILE"
+            : "cquel could not encode a row");
+    return CR_UNKNOWN_ERROR;
+}
+
+void cq_load_attach(struct dbconn *con, void *load)
+{
+    mysql_set_local_infile_handler(con->con, load_init, load_read, load_end,
+            load_error, load);
+}
+
+int cq_load_dlist(struct dbconn con, const char *table,
+        const struct dlist *list)
+{
+    int rc;
+    bool owned;
+    struct cq_buf query;
+
+    if (table == NULL)
+        return 1;
+    if (list == NULL)
+        return 2;
+    if (list->fieldc == 0)
+        return 3;
+
+    /* values inlined as SQL have no place in a data file */
+    for (const struct drow *r = list->first; r != NULL; r = r->next)
+        for (size_t i = 0; i < r->fieldc; ++i)
+            if (r->lengths[i] && r->values[i][0] == '\\')
+                return cq_insert(con, table, list);
+
+    rc = cq_acquire(&con, &owned);
+    if (rc)
+        return 200;
+
+    cq_buf_init(&query);
+    if (!cq_buf_printf(&query, "LOAD DATA LOCAL INFILE 'cquel' INTO TABLE %s "
+                "CHARACTER SET %s FIELDS TERMINATED BY '\\t' ESCAPED BY '\\\\' "
+                "LINES TERMINATED BY '\\n' (", table,
+                mysql_character_set_name(con.con))
+            || cq_dlist_fields_to_utf8(&con, &query, *list)
+            || !cq_buf_puts(&query, ")")) {
+        cq_buf_free(&query);
+        cq_release(&con, owned);
+        return 100;
+    }
+
+    struct load l = {
+        .row = list->first,
+        .off = 0,
+        .rc = 0
+    };
+    cq_buf_init(&l.pending);
+
+    cq_load_attach(&con, &l);
+    rc = cq_query_buf(&con, &query);
+    cq_load_attach(&con, NULL);
+
+    if (l.rc) {
+        rc = l.rc;
+    } else if (rc) {
+        rc = 201;
+    } else if (con.on_batch != NULL) {
+        con.on_batch(0, cq_dlist_size(list), mysql_affected_rows(con.con),
+                con.batch_data);
+    }
+
+    cq_buf_free(&l.pending);
+    cq_buf_free(&query);
+    cq_release(&con, owned);
+    return rc;
+}
@@ -0,0 +1,279 @@
+/*
+ *  cquel - MySQL C API wrapper with dynamic data structures
+ *  Copyright (C) 2014 Delwink, LLC
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as published by
+ *  the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "cquel.h"
+#include "cqstatic.h"
+
+struct cq_meta {
+    char *host;
+    char *database;
+    char *table;
+
+    char *primkey;
+    time_t primkey_at;
+
+    char **fields;
+    size_t fieldc;
+    time_t fields_at;
+
+    struct cq_meta *next;
+};
+
+static char *dup_str(const char *s)
+{
+    if (s == NULL)
+        return NULL;
+
+    size_t len = strlen(s);
+    char *d = malloc(len + 1);
+    if (d != NULL)
+        memcpy(d, s, len + 1);
+    return d;
+}
+
+static bool str_eq(const char *a, const char *b)
+{
+    if (a == NULL || b == NULL)
+        return a == b;
+    return !strcmp(a, b);
+}
+
+static void free_fields(struct cq_meta *m)
+{
+    for (size_t i = 0; i < m->fieldc; ++i)
+        free(m->fields[i]);
+    free(m->fields);
+
+    m->fields = NULL;
+    m->fieldc = 0;
+}
+
+static void free_meta(struct cq_meta *m)
+{
+    free(m->host);
+    free(m->database);
+    free(m->table);
+    free(m->primkey);
+    free_fields(m);
+    free(m);
+}
+
+static bool fresh(const struct cq_ctx *ctx, time_t at)
+{
+    return at && time(NULL) - at < (time_t) ctx->meta_ttl;
+}
+
+static struct cq_meta *meta_find(const struct cq_ctx *ctx,
+        const struct dbconn *con, const char *table)
+{
+    for (struct cq_meta *m = ctx->meta_head; m != NULL; m = m->next)
+        if (str_eq(m->table, table) && str_eq(m->database, con->database)
+                && str_eq(m->host, con->host))
+            return m;
+    return NULL;
+}
+
+static struct cq_meta *meta_find_or_add(struct cq_ctx *ctx,
+        const struct dbconn *con, const char *table)
+{
+    struct cq_meta *m = meta_find(ctx, con, table);
+    if (m != NULL)
+        return m;
+
+    m = calloc(1, sizeof(struct cq_meta));
+    if (m == NULL)
+        return NULL;
+
+    m->host = dup_str(con->host);
+    m->database = dup_str(con->database);
+    m->table = dup_str(table);
+    if (m->table == NULL || (con->host != NULL && m->host == NULL)
+            || (con->database != NULL && m->database == NULL)) {
+        free_meta(m);
+        return NULL;
+    }
+
+    m->next = ctx->meta_head;
+    ctx->meta_head = m;
+    return m;
+}
+
+char *cq_meta_get_primkey(const struct dbconn *con, const char *table)
+{
+    struct cq_ctx *ctx = cq_ctx_get(con->ctx);
+    char *out = NULL;
+
+    pthread_mutex_lock(&ctx->meta_lock);
+
+    struct cq_meta *m = meta_find(ctx, con, table);
+    if (m != NULL && fresh(ctx, m->primkey_at))
+        out = dup_str(m->primkey);
+
+    pthread_mutex_unlock(&ctx->meta_lock);
+
+    atomic_fetch_add(out == NULL ? &ctx->meta_misses : &ctx->meta_hits, 1);
+    return out;
+}
+
+void cq_meta_put_primkey(const struct dbconn *con, const char *table,
+        const char *primkey)
+{
+    struct cq_ctx *ctx = cq_ctx_get(con->ctx);
+
+    pthread_mutex_lock(&ctx->meta_lock);
+
+    struct cq_meta *m = ctx->meta_ttl ? meta_find_or_add(ctx, con, table)
+            : NULL;
+    if (m != NULL) {
+        char *copy = dup_str(primkey);
+        if (copy != NULL) {
+            free(m->primkey);
+            m->primkey = copy;
+            m->primkey_at = time(NULL);
+        }
+    }
+
+    pthread_mutex_unlock(&ctx->meta_lock);
+}
+
+int cq_meta_get_fields(const struct dbconn *con, const char *table,
+        size_t *out_fieldc, char **out_names, size_t nblen)
+{
+    struct cq_ctx *ctx = cq_ctx_get(con->ctx);
+    int rc = 1;
+
+    pthread_mutex_lock(&ctx->meta_lock);
+
+    struct cq_meta *m = meta_find(ctx, con, table);
+    if (m != NULL && fresh(ctx, m->fields_at)) {
+        rc = 0;
+        for (size_t i = 0; out_names != NULL && i < m->fieldc; ++i) {
+            if (strlen(m->fields[i]) >= nblen) {
+                rc = 2;
+                break;
+            }
+            strcpy(out_names[i], m->fields[i]);
+        }
+
+        if (!rc && out_fieldc != NULL)
+            *out_fieldc = m->fieldc;
+    }
+
+    pthread_mutex_unlock(&ctx->meta_lock);
+
+    atomic_fetch_add(rc == 1 ? &ctx->meta_misses : &ctx->meta_hits, 1);
+    return rc;
+}
+
+void cq_meta_put_fields(const struct dbconn *con, const char *table,
+        size_t fieldc, char * const *names)
+{
+    char **fields = calloc(fieldc ? fieldc : 1, sizeof(char *));
+    if (fields == NULL)
+        return;
+
+    for (size_t i = 0; i < fieldc; ++i) {
+        fields[i] = dup_str(names[i]);
+        if (fields[i] == NULL) {
+            for (size_t j = 0; j < i; ++j)
+                free(fields[j]);
+            free(fields);
+            return;
+        }
+    }
+
+    struct cq_ctx *ctx = cq_ctx_get(con->ctx);
+
+    pthread_mutex_lock(&ctx->meta_lock);
+
+    struct cq_meta *m = ctx->meta_ttl ? meta_find_or_add(ctx, con, table)
+            : NULL;
+    if (m != NULL) {
+        free_fields(m);
+        m->fields = fields;
+        m->fieldc = fieldc;
+        m->fields_at = time(NULL);
+        fields = NULL;
+    }
+
+    pthread_mutex_unlock(&ctx->meta_lock);
+
+    if (fields != NULL) {
+        for (size_t i = 0; i < fieldc; ++i)
+            free(fields[i]);
+        free(fields);
+    }
+}
+
+void cq_meta_invalidate(struct dbconn con, const char *table)
+{
+    struct cq_ctx *ctx = cq_ctx_get(con.ctx);
+
+    pthread_mutex_lock(&ctx->meta_lock);
+
+    struct cq_meta **link = &ctx->meta_head;
+    while (*link != NULL) {
+        struct cq_meta *m = *link;
+
+        if ((table == NULL || str_eq(m->table, table))
+                && str_eq(m->database, con.database)
+                && str_eq(m->host, con.host)) {
+            *link = m->next;
+            free_meta(m);
+        } else {
+            link = &m->next;
+        }
+    }
+
+    pthread_mutex_unlock(&ctx->meta_lock);
+}
+
+void cq_meta_clear(struct cq_ctx *ctx)
+{
+    pthread_mutex_lock(&ctx->meta_lock);
+
+    while (ctx->meta_head != NULL) {
+        struct cq_meta *m = ctx->meta_head;
+        ctx->meta_head = m->next;
+        free_meta(m);
+    }
+
+    pthread_mutex_unlock(&ctx->meta_lock);
+}
+
+void cq_meta_set_ttl(unsigned int seconds)
+{
+    cq_ctx_set_meta_ttl(NULL, seconds);
+}
+
+void cq_meta_stats(unsigned long long *hits, unsigned long long *misses)
+{
+    struct cq_stats stats;
+
+    cq_ctx_stats(NULL, &stats);
+    if (hits != NULL)
+        *hits = stats.meta_hits;
+    if (misses != NULL)
+        *misses = stats.meta_misses;
+}
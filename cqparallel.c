@@ -0,0 +1,130 @@
+/*
+ *  cquel - MySQL C API wrapper with dynamic data structures
+ *  Copyright (C) 2014 Delwink, LLC
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as published by
+ *  the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "cquel.h"
+#include "cqstatic.h"
+
+/* one contiguous range of rows and the outcome of sending it */
+struct part {
+    struct cq_pool *pool;
+    const char *table;
+    const struct dlist *list;
+
+    const struct drow *start;
+    size_t count;
+    size_t base;
+
+    pthread_t thread;
+    bool started;
+    int rc;
+    unsigned long long affected;
+};
+
+static void *insert_part(void *arg)
+{
+    struct part *p = arg;
+    struct dbconn con = cq_pool_proto(p->pool);
+    struct cq_txn txn;
+
+    /* ranges commit out of order, so no one count of committed rows holds */
+    con.committed = NULL;
+
+    /* an idle pooled connection may have been opened by another thread */
+    if (cq_thread_init() || cq_pool_checkout(p->pool, &con)) {
+        p->rc = 200;
+        return NULL;
+    }
+
+    p->rc = cq_txn_begin(&con, &txn);
+    if (!p->rc)
+        p->rc = cq_insert_rows(&con, p->table, p->list, p->start, p->count,
+                p->base, &p->affected);
+    p->rc = cq_txn_end(&con, p->rc);
+
+    cq_pool_checkin(p->pool, &con);
+    return NULL;
+}
+
+int cq_insert_parallel(struct cq_pool *pool, const char *table,
+        const struct dlist *list, size_t nthreads,
+        unsigned long long *out_rows)
+{
+    if (pool == NULL)
+        return 1;
+    if (table == NULL)
+        return 2;
+    if (list == NULL)
+        return 3;
+    if (nthreads == 0)
+        return 4;
+
+    if (out_rows != NULL)
+        *out_rows = 0;
+
+    size_t rowc = cq_dlist_size(list);
+    if (rowc == 0)
+        return 0;
+    if (nthreads > rowc)
+        nthreads = rowc;
+
+    struct part *parts = calloc(nthreads, sizeof(struct part));
+    if (parts == NULL)
+        return -1;
+
+    /* the list is only read from here on, so the workers can share it */
+    size_t base = 0;
+    for (size_t i = 0; i < nthreads; ++i) {
+        struct part *p = &parts[i];
+
+        p->pool = pool;
+        p->table = table;
+        p->list = list;
+        p->base = base;
+        p->count = rowc / nthreads + (i < rowc % nthreads);
+        p->start = cq_dlist_at(list, base);
+        base += p->count;
+    }
+
+    /* the calling thread sends the last range itself */
+    for (size_t i = 0; i + 1 < nthreads; ++i)
+        parts[i].started = !pthread_create(&parts[i].thread, NULL,
+                insert_part, &parts[i]);
+    insert_part(&parts[nthreads - 1]);
+
+    int rc = 0;
+    for (size_t i = 0; i < nthreads; ++i) {
+        struct part *p = &parts[i];
+
+        /* a range whose thread could not be started is sent here instead */
+        if (p->started)
+            pthread_join(p->thread, NULL);
+        else if (i + 1 < nthreads)
+            insert_part(p);
+
+        if (!rc)
+            rc = p->rc;
+        if (out_rows != NULL)
+            *out_rows += p->affected;
+    }
+
+    free(parts);
+    return rc;
+}
@@ -0,0 +1,259 @@
+/*
+ *  cquel - MySQL C API wrapper with dynamic data structures
+ *  Copyright (C) 2014 Delwink, LLC
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as published by
+ *  the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <mysql.h>
+
+#include "cquel.h"
+#include "cqstatic.h"
+
+/* status of a statement which has not been run */
+#define CQ_PIPE_UNRUN 2
+
+struct pipe_stmt {
+    size_t off;
+    size_t len;
+    bool call;
+
+    int rc;
+    unsigned long long affected;
+};
+
+/* the statements are kept joined by ';', so that any run of them can be sent
+   as it stands */
+struct cq_pipeline {
+    struct cq_buf text;
+
+    struct pipe_stmt *stmts;
+    size_t n;
+    size_t cap;
+};
+
+struct cq_pipeline *cq_new_pipeline(void)
+{
+    struct cq_pipeline *p = malloc(sizeof(struct cq_pipeline));
+    if (p == NULL)
+        return NULL;
+
+    cq_buf_init(&p->text);
+    p->stmts = NULL;
+    p->n = 0;
+    p->cap = 0;
+    return p;
+}
+
+void cq_free_pipeline(struct cq_pipeline *p)
+{
+    if (p == NULL)
+        return;
+
+    cq_buf_free(&p->text);
+    free(p->stmts);
+    free(p);
+}
+
+void cq_pipeline_clear(struct cq_pipeline *p)
+{
+    if (p == NULL)
+        return;
+
+    cq_buf_reset(&p->text);
+    p->n = 0;
+}
+
+size_t cq_pipeline_size(const struct cq_pipeline *p)
+{
+    return p == NULL ? 0 : p->n;
+}
+
+/* a CALL answers with a status after any result sets of its own */
+static bool is_call(const char *query, size_t len)
+{
+    return len > 4 && !strncasecmp(query, "CALL", 4)
+            && isspace((unsigned char) query[4]);
+}
+
+int cq_pipeline_add(struct cq_pipeline *p, const char *query)
+{
+    if (p == NULL)
+        return 1;
+    if (query == NULL)
+        return 2;
+
+    /* the separators are added here, so trailing ones are dropped */
+    size_t len = strlen(query);
+    while (len && (query[len-1] == ';'
+                || isspace((unsigned char) query[len-1])))
+        --len;
+    while (len && isspace((unsigned char) *query)) {
+        ++query;
+        --len;
+    }
+    if (len == 0)
+        return 3;
+
+    if (p->n == p->cap) {
+        size_t cap = p->cap ? p->cap * 2 : 8;
+        struct pipe_stmt *stmts = realloc(p->stmts,
+                cap * sizeof(struct pipe_stmt));
+        if (stmts == NULL)
+            return -1;
+
+        p->stmts = stmts;
+        p->cap = cap;
+    }
+
+    size_t mark = p->text.len;
+    if ((p->n && !cq_buf_append(&p->text, ";", 1))
+            || !cq_buf_append(&p->text, query, len)) {
+        cq_buf_truncate(&p->text, mark);
+        return -2;
+    }
+
+    struct pipe_stmt *s = &p->stmts[p->n++];
+    s->off = p->text.len - len;
+    s->len = len;
+    s->call = is_call(query, len);
+    s->rc = CQ_PIPE_UNRUN;
+    s->affected = 0;
+    return 0;
+}
+
+/* reads the current result, discarding any rows it holds */
+static int take_result(MYSQL *mysql, unsigned long long *affected)
+{
+    if (mysql_field_count(mysql) == 0) {
+        *affected = mysql_affected_rows(mysql);
+        return 0;
+    }
+
+    MYSQL_RES *res = mysql_store_result(mysql);
+    if (res == NULL)
+        return 1;
+
+    *affected = mysql_affected_rows(mysql);
+    mysql_free_result(res);
+    return 0;
+}
+
+/* reads every result of one statement, starting with the current one */
+static int stmt_results(MYSQL *mysql, struct pipe_stmt *s)
+{
+    bool rows = mysql_field_count(mysql) > 0;
+
+    if (take_result(mysql, &s->affected))
+        return 1;
+
+    /* the result sets of a CALL end with its status */
+    while (s->call && rows) {
+        if (mysql_next_result(mysql))
+            return 1;
+
+        rows = mysql_field_count(mysql) > 0;
+        if (take_result(mysql, &s->affected))
+            return 1;
+    }
+
+    return 0;
+}
+
+/* sends statements [first, end) as one packet; the server stops at the first
+   which fails */
+static int run_packet(struct dbconn *con, struct cq_pipeline *p, size_t first,
+        size_t end)
+{
+    MYSQL *mysql = con->con;
+    const struct pipe_stmt *last = &p->stmts[end - 1];
+    size_t off = p->stmts[first].off;
+
+    int rc = 0;
+    int err = mysql_real_query(mysql, p->text.data + off,
+            last->off + last->len - off);
+
+    for (size_t i = first; i < end; ++i) {
+        struct pipe_stmt *s = &p->stmts[i];
+
+        if (!err)
+            err = stmt_results(mysql, s);
+        s->rc = cq_count_query(con, err) ? 201 : 0;
+        if (s->rc) {
+            rc = 201;
+            break;
+        }
+
+        if (i + 1 < end && mysql_next_result(mysql))
+            err = 1;
+    }
+
+    /* leave nothing unread, in case a statement answered more than expected */
+    while (mysql_more_results(mysql) && !mysql_next_result(mysql)) {
+        MYSQL_RES *res = mysql_store_result(mysql);
+        if (res != NULL)
+            mysql_free_result(res);
+    }
+
+    return rc;
+}
+
+int cq_pipeline_run(struct dbconn con, struct cq_pipeline *p)
+{
+    int rc;
+    bool owned;
+
+    if (p == NULL)
+        return 1;
+
+    for (size_t i = 0; i < p->n; ++i) {
+        p->stmts[i].rc = CQ_PIPE_UNRUN;
+        p->stmts[i].affected = 0;
+    }
+
+    rc = cq_acquire(&con, &owned);
+    if (rc)
+        return 200;
+
+    /* pack statements into each packet while they fit in the query length; a
+       longer statement is sent alone */
+    size_t qlen = cq_qlen(&con);
+    for (size_t i = 0; i < p->n && !rc;) {
+        size_t end = i + 1;
+        while (end < p->n && p->stmts[end].off + p->stmts[end].len
+                - p->stmts[i].off <= qlen)
+            ++end;
+
+        rc = run_packet(&con, p, i, end);
+        i = end;
+    }
+
+    cq_release(&con, owned);
+    return rc;
+}
+
+int cq_pipeline_status(const struct cq_pipeline *p, size_t index,
+        unsigned long long *affected)
+{
+    if (p == NULL || index >= p->n)
+        return 1;
+
+    if (affected != NULL)
+        *affected = p->stmts[index].affected;
+    return p->stmts[index].rc;
+}
@@ -0,0 +1,317 @@
+/*
+ *  cquel - MySQL C API wrapper with dynamic data structures
+ *  Copyright (C) 2014 Delwink, LLC
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as published by
+ *  the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+#include <mysql.h>
+
+#include "cquel.h"
+#include "cqstatic.h"
+
+/* connections idle for less than this many seconds are not pinged */
+#define CQ_POOL_PING_AFTER 1
+
+struct cq_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t avail;
+
+    struct dbconn proto;
+    size_t maxcon;
+    size_t open;
+    unsigned int idle;
+
+    /* idle connections; the most recently used is on top */
+    struct dbconn *stack;
+    time_t *since;
+    bool *unreset;
+    size_t nidle;
+};
+
+struct cq_pool *cq_new_pool(struct dbconn con, size_t maxcon,
+        unsigned int idle)
+{
+    if (maxcon == 0)
+        return NULL;
+
+    struct cq_pool *pool = malloc(sizeof(struct cq_pool));
+    if (pool == NULL)
+        return NULL;
+
+    pool->stack = calloc(maxcon, sizeof(struct dbconn));
+    if (pool->stack == NULL) {
+        free(pool);
+        return NULL;
+    }
+
+    pool->since = calloc(maxcon, sizeof(time_t));
+    if (pool->since == NULL) {
+        free(pool->stack);
+        free(pool);
+        return NULL;
+    }
+
+    pool->unreset = calloc(maxcon, sizeof(bool));
+    if (pool->unreset == NULL) {
+        free(pool->since);
+        free(pool->stack);
+        free(pool);
+        return NULL;
+    }
+
+    if (pthread_mutex_init(&pool->lock, NULL)) {
+        free(pool->unreset);
+        free(pool->since);
+        free(pool->stack);
+        free(pool);
+        return NULL;
+    }
+
+    if (pthread_cond_init(&pool->avail, NULL)) {
+        pthread_mutex_destroy(&pool->lock);
+        free(pool->unreset);
+        free(pool->since);
+        free(pool->stack);
+        free(pool);
+        return NULL;
+    }
+
+    pool->proto = con;
+    pool->proto.con = NULL;
+    pool->proto.isopen = false;
+    pool->proto.pool = NULL;
+    pool->proto.stmts = NULL;
+    pool->proto.txn = NULL;
+    pool->maxcon = maxcon;
+    pool->open = 0;
+    pool->idle = idle;
+    pool->nidle = 0;
+    return pool;
+}
+
+/* must hold the lock; moves expired connections to out and returns count */
+static size_t pool_take_expired(struct cq_pool *pool, time_t now,
+        struct dbconn *out)
+{
+    size_t expired = 0;
+
+    if (pool->idle == 0)
+        return 0;
+
+    /* the bottom of the stack has been idle the longest */
+    while (expired < pool->nidle
+            && difftime(now, pool->since[expired]) >= pool->idle)
+        ++expired;
+
+    for (size_t i = 0; i < expired; ++i)
+        out[i] = pool->stack[i];
+
+    for (size_t i = expired; i < pool->nidle; ++i) {
+        pool->stack[i - expired] = pool->stack[i];
+        pool->since[i - expired] = pool->since[i];
+        pool->unreset[i - expired] = pool->unreset[i];
+    }
+
+    pool->nidle -= expired;
+    pool->open -= expired;
+    return expired;
+}
+
+static size_t pool_trim(struct cq_pool *pool, bool all)
+{
+    struct dbconn *victims = calloc(pool->maxcon, sizeof(struct dbconn));
+    if (victims == NULL)
+        return 0;
+
+    size_t n;
+    pthread_mutex_lock(&pool->lock);
+    if (all) {
+        for (n = 0; n < pool->nidle; ++n)
+            victims[n] = pool->stack[n];
+        pool->open -= n;
+        pool->nidle = 0;
+    } else {
+        n = pool_take_expired(pool, time(NULL), victims);
+    }
+    if (n)
+        pthread_cond_broadcast(&pool->avail);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (size_t i = 0; i < n; ++i)
+        cq_close_connection(&victims[i]);
+
+    free(victims);
+    return n;
+}
+
+void cq_free_pool(struct cq_pool *pool)
+{
+    if (pool == NULL)
+        return;
+
+    pool_trim(pool, true);
+
+    pthread_cond_destroy(&pool->avail);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->unreset);
+    free(pool->since);
+    free(pool->stack);
+    free(pool);
+}
+
+struct dbconn cq_pool_proto(const struct cq_pool *pool)
+{
+    struct dbconn con = pool->proto;
+
+    con.pool = (struct cq_pool *) pool;
+    return con;
+}
+
+int cq_pool_checkout(struct cq_pool *pool, struct dbconn *out)
+{
+    if (pool == NULL)
+        return 1;
+    if (out == NULL)
+        return 2;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        if (pool->nidle > 0) {
+            struct dbconn c = pool->stack[--pool->nidle];
+            time_t since = pool->since[pool->nidle];
+            bool unreset = pool->unreset[pool->nidle];
+            pthread_mutex_unlock(&pool->lock);
+
+            /* a reset also shows that the connection is alive */
+            bool ok;
+            if (unreset) {
+                cq_stmt_cache_clear(c.stmts);
+                ok = !mysql_reset_connection(c.con);
+            } else {
+                ok = difftime(time(NULL), since) < CQ_POOL_PING_AFTER
+                        || !mysql_ping(c.con);
+            }
+
+            if (ok) {
+                out->con = c.con;
+                out->isopen = true;
+                out->stmts = c.stmts;
+                return 0;
+            }
+
+            cq_close_connection(&c);
+            pthread_mutex_lock(&pool->lock);
+            --pool->open;
+            continue;
+        }
+
+        if (pool->open < pool->maxcon) {
+            ++pool->open;
+            pthread_mutex_unlock(&pool->lock);
+
+            struct dbconn c = pool->proto;
+            if (cq_connect(&c)) {
+                pthread_mutex_lock(&pool->lock);
+                --pool->open;
+                pthread_cond_signal(&pool->avail);
+                pthread_mutex_unlock(&pool->lock);
+                return 200;
+            }
+
+            out->con = c.con;
+            out->isopen = true;
+            out->stmts = c.stmts;
+            return 0;
+        }
+
+        pthread_cond_wait(&pool->avail, &pool->lock);
+    }
+}
+
+static void pool_checkin(struct cq_pool *pool, struct dbconn *con,
+        bool reset)
+{
+    if (pool == NULL || con == NULL)
+        return;
+
+    struct dbconn c = pool->proto;
+    c.con = con->con;
+    c.isopen = con->isopen;
+    c.stmts = con->stmts;
+    con->con = NULL;
+    con->isopen = false;
+    con->stmts = NULL;
+
+    /* resetting the session deallocates its prepared statements */
+    if (reset) {
+        cq_stmt_cache_clear(c.stmts);
+
+        /* drop connections which are broken or cannot shed session state */
+        if (c.isopen && mysql_reset_connection(c.con))
+            cq_close_connection(&c);
+    }
+
+    struct dbconn stale = { .isopen = false };
+    time_t now = time(NULL);
+
+    pthread_mutex_lock(&pool->lock);
+    if (c.isopen) {
+        pool->stack[pool->nidle] = c;
+        pool->since[pool->nidle] = now;
+        pool->unreset[pool->nidle] = !reset;
+        ++pool->nidle;
+
+        /* retire at most one expired connection per checkin */
+        if (pool->idle && pool->nidle > 1
+                && difftime(now, pool->since[0]) >= pool->idle) {
+            stale = pool->stack[0];
+            for (size_t i = 1; i < pool->nidle; ++i) {
+                pool->stack[i - 1] = pool->stack[i];
+                pool->since[i - 1] = pool->since[i];
+                pool->unreset[i - 1] = pool->unreset[i];
+            }
+            --pool->nidle;
+            --pool->open;
+        }
+    } else {
+        --pool->open;
+    }
+    pthread_cond_signal(&pool->avail);
+    pthread_mutex_unlock(&pool->lock);
+
+    if (stale.isopen)
+        cq_close_connection(&stale);
+}
+
+void cq_pool_checkin(struct cq_pool *pool, struct dbconn *con)
+{
+    pool_checkin(pool, con, true);
+}
+
+void cq_pool_checkin_unreset(struct cq_pool *pool, struct dbconn *con)
+{
+    pool_checkin(pool, con, false);
+}
+
+size_t cq_pool_trim(struct cq_pool *pool)
+{
+    if (pool == NULL)
+        return 0;
+
+    return pool_trim(pool, false);
+}
@@ -19,174 +19,247 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
-#include <ctype.h>
 #include <mysql.h>
 
 #include "cquel.h"
+#include "cqstatic.h"
 
-extern size_t CQ_QLEN;
-extern size_t  CQ_FMAXLEN;
+int cq_acquire(struct dbconn *con, bool *owned)
+{
+    /* every thread using the client library must first register with it */
+    if (cq_thread_init())
+        return -1;
+
+    /* a connection opened by the caller is used as-is and left open */
+    *owned = !con->isopen;
+    if (!*owned)
+        return 0;
+
+    if (con->pool != NULL)
+        return cq_pool_checkout(con->pool, con);
+
+    return cq_connect(con);
+}
+
+void cq_release(struct dbconn *con, bool owned)
+{
+    if (!owned)
+        return;
+
+    if (con->pool != NULL)
+        cq_pool_checkin(con->pool, con);
+    else
+        cq_close_connection(con);
+}
 
 int cq_query(struct dbconn *con, const char *query)
 {
-    return mysql_query(con->con, query);
+    return cq_count_query(con, mysql_query(con->con, query));
 }
 
-int cq_fields_to_utf8(struct dbconn *con, char *buf, size_t buflen,
-        size_t fieldc, char * const *fieldnames, bool usequotes)
+int cq_query_buf(struct dbconn *con, const struct cq_buf *query)
 {
-    int rc = 0;
-    bool connecting = !con->isopen;
-    size_t num_left = fieldc, written = 0;
+    return cq_count_query(con,
+            mysql_real_query(con->con, query->data, query->len));
+}
 
-    if (num_left == 0)
-        return 1;
+static bool has_column(const MYSQL_FIELD *fields, size_t num_fields,
+        const MYSQL_FIELD *owner, const char *name, size_t len)
+{
+    for (size_t i = 0; i < num_fields; ++i)
+        if ((fields[i].flags & PRI_KEY_FLAG)
+                && !strcmp(fields[i].org_table, owner->org_table)
+                && !strcmp(fields[i].db, owner->db)
+                && !strcmp(fields[i].name, fields[i].org_name)
+                && strlen(fields[i].org_name) == len
+                && !strncmp(fields[i].org_name, name, len))
+            return true;
+    return false;
+}
 
-    char *temp = calloc(CQ_FMAXLEN+3, sizeof(char));
-    if (NULL == temp)
-        return -1;
+char *cq_fields_primkey(struct dbconn *con, const MYSQL_FIELD *fields,
+        size_t num_fields, bool lookup)
+{
+    const MYSQL_FIELD *owner = NULL;
+    char *key;
+
+    /* a key spread over several base tables, as in a join, is no key at all */
+    for (size_t i = 0; i < num_fields; ++i) {
+        if (!(fields[i].flags & PRI_KEY_FLAG))
+            continue;
 
-    char *field = calloc((CQ_FMAXLEN+3)*2+1, sizeof(char));
-    if (NULL == field) {
-        free(temp);
-        return -2;
+        if (owner == NULL) {
+            owner = &fields[i];
+        } else if (strcmp(owner->org_table, fields[i].org_table)
+                || strcmp(owner->db, fields[i].db)) {
+            return calloc(1, sizeof(char));
+        }
     }
 
-    /* prevent appending to buffer */
-    buf[0] = '\0';
+    if (owner == NULL || owner->org_table[0] == '\0')
+        return calloc(1, sizeof(char));
 
-    if (connecting)
-        cq_connect(con);
-    for (size_t i = 0; i < fieldc; ++i) {
-        bool escaped = fieldnames[i][0] == '\\';
-        const char *orig = escaped ? &fieldnames[i][1] : fieldnames[i];
-        const char *value;
-
-        bool isstr = false;
-        if (!escaped) {
-            mysql_real_escape_string(con->con, field, orig, strlen(orig));
-            value = field;
-            if (usequotes)
-                for (size_t j = 0; j < strlen(value); ++j) {
-                    if (!isdigit(value[j])) {
-                        isstr = true;
-                        break;
-                    }
-                }
-        } else {
-            value = orig;
-        }
+    /* the flags mark each column of the key but not how many there are, so
+       the whole key is looked up; a key which is not known, or of which part
+       was not selected or was renamed, would update rows it does not
+       identify */
+    if (cq_table_primkey(con, owner->db, owner->org_table, lookup, &key))
+        return calloc(1, sizeof(char));
+
+    for (const char *p = key; *p != '\0'; ) {
+        const char *end = strchr(p, ',');
+        if (end == NULL)
+            end = p + strlen(p);
 
-        const char *a = isstr ? "'" : "";
-        const char *c = --num_left > 0 ? "," : "";
-        written += snprintf(temp, CQ_FMAXLEN+3, "%s%s%s%s", a, value, a, c);
-        if (written >= buflen) {
-            rc = 2;
+        if (!has_column(fields, num_fields, owner, p, end - p)) {
+            key[0] = '\0';
             break;
         }
 
-        strcat(buf, temp);
+        p = *end ? end + 1 : end;
     }
-    if (connecting)
-        cq_close_connection(con);
 
-    free(field);
-    free(temp);
-    return rc;
+    return key;
 }
 
-int cq_dlist_to_update_utf8(struct dbconn *con, char *buf, size_t buflen,
-        struct dlist list, struct drow row)
+int cq_fields_to_utf8(struct dbconn *con, struct cq_buf *buf, size_t fieldc,
+        char * const *fieldnames, const size_t *lengths, bool usequotes)
 {
     int rc = 0;
-    bool connecting = !con->isopen;
-    size_t num_left = list.fieldc, written = 0;
 
-    if (num_left == 0)
+    if (fieldc == 0)
         return 1;
 
-    char *temp = calloc(CQ_FMAXLEN+3, sizeof(char));
-    if (NULL == temp)
-        return -1;
+    for (size_t i = 0; i < fieldc; ++i) {
+        size_t len = lengths ? lengths[i] : strlen(fieldnames[i]);
 
-    char *tempf = calloc((CQ_FMAXLEN+3)*2+1, sizeof(char));
-    if (NULL == tempf) {
-        free(temp);
-        return -2;
+        if ((i && !cq_buf_append(buf, ",", 1))
+                || !cq_buf_value(buf, con, fieldnames[i], len, usequotes)) {
+            rc = -1;
+            break;
+        }
     }
 
-    char *tempv = calloc((CQ_FMAXLEN+3)*2+1, sizeof(char));
-    if (NULL == tempv) {
-        free(temp);
-        free(tempf);
-        return -3;
-    }
+    return rc;
+}
 
-    /* prevent appending to buffer */
-    buf[0] = '\0';
+int cq_dlist_to_update_utf8(struct dbconn *con, struct cq_buf *buf,
+        struct dlist list, struct drow row, const size_t *keys, size_t keyc)
+{
+    int rc = 0;
+    bool first = true;
+
+    /* the key fields are left out of the SET list */
+    if (list.fieldc <= keyc)
+        return 1;
 
-    if (connecting)
-        cq_connect(con);
     for (size_t i = 0; i < list.fieldc; ++i) {
-        if (!strcmp(list.fieldnames[i], list.primkey)) {
-            --num_left;
+        bool iskey = false;
+        for (size_t k = 0; k < keyc && !iskey; ++k)
+            iskey = keys[k] == i;
+        if (iskey)
             continue;
-        }
 
-        bool v_escaped = row.values[i][0] == '\\';
-        const char *v_orig = v_escaped ?
-                &row.values[i][1] : row.values[i];
-        const char *f = list.fieldnames[i], *v_value;
-
-        mysql_real_escape_string(con->con, tempf, f, strlen(f));
-
-        bool isstr = false;
-        if (!v_escaped) {
-            mysql_real_escape_string(con->con, tempv, v_orig, strlen(v_orig));
-            v_value = tempv;
-            for (size_t j = 0; j < strlen(v_value); ++j) {
-                if (!isdigit(v_value[j])) {
-                    isstr = true;
-                    break;
-                }
-            }
-        } else {
-            v_value = v_orig;
+        const char *f = list.fieldnames[i];
+        if ((!first && !cq_buf_append(buf, ",", 1))
+                || !cq_buf_value(buf, con, f, strlen(f), false)
+                || !cq_buf_append(buf, "=", 1)
+                || !cq_buf_cell(buf, con, &list, &row, i)) {
+            rc = -1;
+            break;
         }
+        first = false;
+    }
 
-        const char *a = isstr ? "'" : "";
-        const char *c = --num_left > 0 ? "," : "";
-        written += snprintf(temp, CQ_FMAXLEN+3, "%s=%s%s%s%s",
-                tempf,
-                a, v_value, a, c);
-        if (written >= buflen) {
-            rc = 2;
-            break;
+    return rc;
+}
+
+int cq_dlist_to_case_utf8(struct dbconn *con, struct cq_buf *buf,
+        const struct dlist *list, size_t pindex, const struct drow *first,
+        size_t rows)
+{
+    const struct drow *r;
+    size_t n;
+
+    /* one CASE expression per column, choosing each row's value by its key */
+    bool firstcol = true;
+    for (size_t i = 0; i < list->fieldc; ++i) {
+        if (i == pindex)
+            continue;
+
+        if ((!firstcol && !cq_buf_puts(buf, ","))
+                || !cq_buf_printf(buf, "%s=CASE %s", list->fieldnames[i],
+                        list->primkey))
+            return -1;
+        firstcol = false;
+
+        for (r = first, n = 0; n < rows; r = r->next, ++n) {
+            if (!cq_buf_puts(buf, " WHEN ")
+                    || !cq_buf_cell(buf, con, list, r, pindex)
+                    || !cq_buf_puts(buf, " THEN ")
+                    || !cq_buf_cell(buf, con, list, r, i))
+                return -2;
         }
 
-        strcat(buf, temp);
+        if (!cq_buf_puts(buf, " END"))
+            return -3;
     }
-    if (connecting)
-        cq_close_connection(con);
 
-    free(tempv);
-    free(tempf);
-    free(temp);
-    return rc;
+    if (!cq_buf_printf(buf, " WHERE %s IN (", list->primkey))
+        return -4;
+
+    for (r = first, n = 0; n < rows; r = r->next, ++n) {
+        if (!cq_buf_cell(buf, con, list, r, pindex)
+                || !cq_buf_puts(buf, n + 1 < rows ? "," : ")"))
+            return -5;
+    }
+
+    return 0;
+}
+
+size_t cq_case_row_cost(const struct dlist *list, size_t pindex,
+        const struct drow *row)
+{
+    /* worst case: every character escaped and the value quoted, which also
+       covers the four characters of NULL */
+    size_t key = row->lengths[pindex]*2 + 4;
+    size_t cost = key + 1;
+
+    for (size_t i = 0; i < list->fieldc; ++i) {
+        if (i == pindex)
+            continue;
+
+        cost += strlen(" WHEN ") + key + strlen(" THEN ")
+                + row->lengths[i]*2 + 4;
+    }
+
+    return cost;
 }
 
-int cq_dlist_fields_to_utf8(struct dbconn *con, char *buf, size_t buflen,
+int cq_dlist_fields_to_utf8(struct dbconn *con, struct cq_buf *buf,
         struct dlist list)
 {
-    return cq_fields_to_utf8(con, buf, buflen, list.fieldc, list.fieldnames,
+    return cq_fields_to_utf8(con, buf, list.fieldc, list.fieldnames, NULL,
             false);
 }
 
-int cq_drow_to_utf8(struct dbconn *con, char *buf, size_t buflen,
-        struct drow row)
+int cq_drow_to_utf8(struct dbconn *con, struct cq_buf *buf,
+        const struct dlist *list, const struct drow *row)
 {
-    return cq_fields_to_utf8(con, buf, buflen, row.fieldc, row.values,
-            true);
+    int rc = 0;
+
+    if (row->fieldc == 0)
+        return 1;
+
+    for (size_t i = 0; i < row->fieldc; ++i) {
+        if ((i && !cq_buf_append(buf, ",", 1))
+                || !cq_buf_cell(buf, con, list, row, i)) {
+            rc = -1;
+            break;
+        }
+    }
+
+    return rc;
 }
 
 int dlist_meta_cmp(const struct dlist *a, const struct dlist *b)
@@ -211,39 +284,33 @@ int grant_revoke(struct dbconn con, const char *act, const char *perms,
         const char *extra)
 {
     int rc;
-    char *query;
-    const char *fmt = "%s %s ON %s %s '%s'@'%s' %s";
+    bool owned;
+    struct cq_buf query;
 
     if (NULL == act || NULL == perms || NULL == table || NULL == user
             || NULL == host || NULL == extra)
         return 1;
 
-    query = calloc(CQ_QLEN, sizeof(char));
-    if (NULL == query)
-        return -1;
-
-    rc = snprintf(query, CQ_QLEN, fmt,
-            act,
-            perms,
-            table,
-            strcmp(act, u8"GRANT") ? u8"FROM" : u8"TO",
-            user,
-            host,
-            extra);
-    if (CQ_QLEN <= (size_t) rc) {
-        free(query);
-        return 100;
-    }
-
-    rc = cq_connect(&con);
-    if (rc) {
-        free(query);
+    /* the account is escaped on the connection that runs the statement */
+    rc = cq_acquire(&con, &owned);
+    if (rc)
         return 200;
+
+    cq_buf_init(&query);
+    if (!cq_buf_printf(&query, "%s %s ON %s %s ", act, perms, table,
+                strcmp(act, u8"GRANT") ? u8"FROM" : u8"TO")
+            || !cq_buf_string(&query, &con, user, strlen(user))
+            || !cq_buf_puts(&query, "@")
+            || !cq_buf_string(&query, &con, host, strlen(host))
+            || !cq_buf_printf(&query, " %s", extra)) {
+        cq_buf_free(&query);
+        cq_release(&con, owned);
+        return -1;
     }
 
-    rc = mysql_query(con.con, query);
+    rc = cq_query_buf(&con, &query);
 
-    cq_close_connection(&con);
-    free(query);
+    cq_buf_free(&query);
+    cq_release(&con, owned);
     return rc ? 201 : 0;
 }
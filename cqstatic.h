@@ -15,19 +15,226 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdatomic.h>
+#include <pthread.h>
+
+struct cq_meta;
+
+/* limits, caches and counters shared by the connections that name it */
+struct cq_ctx {
+    size_t qlen;
+    size_t fmaxlen;
+
+    /* the server's packet limit, looked up once if qlen is 0 */
+    atomic_ullong packet;
+
+    pthread_mutex_t meta_lock;
+    struct cq_meta *meta_head;
+    unsigned int meta_ttl;
+
+    atomic_ullong queries;
+    atomic_ullong errors;
+    atomic_ullong connects;
+    atomic_ullong meta_hits;
+    atomic_ullong meta_misses;
+};
+
+struct cq_ctx *cq_ctx_get(struct cq_ctx *ctx);
+
+size_t cq_qlen(struct dbconn *con);
+
+int cq_thread_init(void);
+
+int cq_count_query(const struct dbconn *con, int rc);
+
+void cq_meta_clear(struct cq_ctx *ctx);
+
+/* an append-only string that grows as needed, always null-terminated once
+   anything has been appended */
+struct cq_buf {
+    char *data;
+    size_t len;
+    size_t cap;
+
+    /* whether values escaped on escon can use cq_escape(), decided on the
+       first and kept for the life of the buffer */
+    const void *escon;
+    bool plain;
+};
+
+void cq_buf_init(struct cq_buf *buf);
+
+void cq_buf_free(struct cq_buf *buf);
+
+void cq_buf_truncate(struct cq_buf *buf, size_t len);
+
+void cq_buf_reset(struct cq_buf *buf);
+
+bool cq_buf_reserve(struct cq_buf *buf, size_t extra);
+
+bool cq_buf_append(struct cq_buf *buf, const char *s, size_t n);
+
+bool cq_buf_puts(struct cq_buf *buf, const char *s);
+
+bool cq_buf_printf(struct cq_buf *buf, const char *fmt, ...);
+
+bool cq_buf_value(struct cq_buf *buf, struct dbconn *con, const char *value,
+        size_t len, bool usequotes);
+
+bool cq_buf_string(struct cq_buf *buf, struct dbconn *con, const char *value,
+        size_t len);
+
+size_t cq_escape(char *dst, const char *src, size_t len, bool *isnum);
+
+bool cq_plain_escapes(const struct dbconn *con);
+
+struct cq_arena *cq_new_arena(void);
+
+void cq_free_arena(struct cq_arena *arena);
+
+void *cq_arena_alloc(struct cq_arena *arena, size_t size);
+
+void *cq_arena_calloc(struct cq_arena *arena, size_t nmemb, size_t size);
+
+int cq_drow_set_lens(struct drow *row, char * const *values,
+        const unsigned long *lengths);
+
+struct st_mysql_field;
+
+int cq_dlist_set_types(struct dlist *list,
+        const struct st_mysql_field *fields);
+
+int cq_parse_native(enum cq_type type, const char *value, size_t len,
+        union cq_native *out);
+
+void cq_drow_mark_null(struct drow *row, size_t index, bool null);
+
+bool cq_buf_cell(struct cq_buf *buf, struct dbconn *con,
+        const struct dlist *list, const struct drow *row, size_t index);
+
+struct cq_keyindex *cq_new_keyindex(size_t pindex);
+
+void cq_free_keyindex(struct cq_keyindex *keys);
+
+size_t cq_keyindex_field(const struct cq_keyindex *keys);
+
+void cq_keyindex_set_field(struct cq_keyindex *keys, size_t pindex);
+
+int cq_keyindex_add(struct cq_keyindex *keys, struct drow *row);
+
+void cq_keyindex_remove(struct cq_keyindex *keys, const struct drow *row);
+
+struct drow *cq_keyindex_find(const struct cq_keyindex *keys, const char *key,
+        size_t len);
+
+int cq_fieldmap_build(struct dlist *list);
+
+bool cq_fieldmap_find(const struct dlist *list, const char *name,
+        size_t *out);
+
+bool cq_dlist_pindex(const struct dlist *list, size_t *out);
+
+size_t cq_dlist_keyfields(const struct dlist *list, size_t *out);
+
+int cq_acquire(struct dbconn *con, bool *owned);
+
+void cq_release(struct dbconn *con, bool owned);
+
+/* the transaction a batched write runs in, counting what it has sent since
+   the last COMMIT */
+struct cq_txn {
+    bool open;
+    size_t rows;
+    size_t bytes;
+    size_t committed;
+};
+
+int cq_txn_begin(struct dbconn *con, struct cq_txn *txn);
+
+int cq_txn_sent(struct dbconn *con, size_t rows, size_t bytes);
+
+int cq_txn_end(struct dbconn *con, int rc);
+
+struct dbconn cq_pool_proto(const struct cq_pool *pool);
+
+/* returns a connection without the blocking session reset, which is left to
+   whoever checks it out next */
+void cq_pool_checkin_unreset(struct cq_pool *pool, struct dbconn *con);
+
 int cq_query(struct dbconn *con, const char *query);
 
-int cq_fields_to_utf8(struct dbconn *con, char *buf, size_t buflen,
-        size_t fieldc, char * const *fieldnames, bool usequotes);
+int cq_query_buf(struct dbconn *con, const struct cq_buf *query);
+
+struct dlist *cq_new_dlist_ctx(struct cq_ctx *ctx, size_t fieldc,
+        char * const *fieldnames, const char *primkey);
+
+int cq_result_to_dlist(struct dbconn *con, void *result, bool lookup,
+        struct dlist **out);
+
+char *cq_meta_get_primkey(const struct dbconn *con, const char *table);
+
+int cq_table_primkey(struct dbconn *con, const char *db, const char *table,
+        bool lookup, char **out);
+
+void cq_meta_put_primkey(const struct dbconn *con, const char *table,
+        const char *primkey);
+
+int cq_meta_get_fields(const struct dbconn *con, const char *table,
+        size_t *out_fieldc, char **out_names, size_t nblen);
+
+void cq_meta_put_fields(const struct dbconn *con, const char *table,
+        size_t fieldc, char * const *names);
+
+struct cq_stmt_cache *cq_new_stmt_cache(void);
+
+void cq_stmt_cache_clear(struct cq_stmt_cache *cache);
+
+void cq_free_stmt_cache(struct cq_stmt_cache *cache);
+
+bool cq_can_prepare(const struct dbconn *con, size_t fieldc,
+        char * const *values);
+
+bool cq_can_prepare_rows(const struct dbconn *con, const struct drow *start,
+        size_t count);
+
+int cq_prep_insert(struct dbconn *con, const char *table,
+        const struct dlist *list, const struct drow *start, size_t count,
+        size_t base, unsigned long long *affected);
+
+void cq_load_attach(struct dbconn *con, void *load);
+
+int cq_insert_rows(struct dbconn *con, const char *table,
+        const struct dlist *list, const struct drow *start, size_t count,
+        size_t base, unsigned long long *affected);
+
+int cq_prep_update(struct dbconn *con, const char *table,
+        const struct dlist *list, const size_t *keys, size_t keyc);
+
+int cq_prep_proc(struct dbconn *con, const char *proc, char * const *args,
+        size_t num_args);
+
+char *cq_fields_primkey(struct dbconn *con,
+        const struct st_mysql_field *fields, size_t num_fields, bool lookup);
+
+/* the *_utf8 builders escape on con, which the caller must have acquired */
+int cq_fields_to_utf8(struct dbconn *con, struct cq_buf *buf, size_t fieldc,
+        char * const *fieldnames, const size_t *lengths, bool usequotes);
+
+int cq_dlist_to_case_utf8(struct dbconn *con, struct cq_buf *buf,
+        const struct dlist *list, size_t pindex, const struct drow *first,
+        size_t rows);
+
+size_t cq_case_row_cost(const struct dlist *list, size_t pindex,
+        const struct drow *row);
 
-int cq_dlist_to_update_utf8(struct dbconn *con, char *buf, size_t buflen,
-        struct dlist list, struct drow row);
+int cq_dlist_to_update_utf8(struct dbconn *con, struct cq_buf *buf,
+        struct dlist list, struct drow row, const size_t *keys, size_t keyc);
 
-int cq_dlist_fields_to_utf8(struct dbconn *con, char *buf, size_t buflen,
+int cq_dlist_fields_to_utf8(struct dbconn *con, struct cq_buf *buf,
         struct dlist list);
 
-int cq_drow_to_utf8(struct dbconn *con, char *buf, size_t buflen,
-        struct drow row);
+int cq_drow_to_utf8(struct dbconn *con, struct cq_buf *buf,
+        const struct dlist *list, const struct drow *row);
 
 int dlist_meta_cmp(const struct dlist *a, const struct dlist *b);
 
@@ -0,0 +1,449 @@
+/*
+ *  cquel - MySQL C API wrapper with dynamic data structures
+ *  Copyright (C) 2014 Delwink, LLC
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as published by
+ *  the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <mysql.h>
+
+#include "cquel.h"
+#include "cqstatic.h"
+
+/* the server's limit on placeholders in one statement */
+#define CQ_STMT_MAXPARAMS 65535
+
+/* the number of prepared statements kept open on each connection */
+#define CQ_STMT_CACHE 16
+
+struct cq_stmt_cache {
+    unsigned long tick;
+
+    struct {
+        char *sql;
+        MYSQL_STMT *stmt;
+        unsigned long used;
+    } entries[CQ_STMT_CACHE];
+};
+
+struct cq_stmt_cache *cq_new_stmt_cache(void)
+{
+    return calloc(1, sizeof(struct cq_stmt_cache));
+}
+
+void cq_stmt_cache_clear(struct cq_stmt_cache *cache)
+{
+    if (cache == NULL)
+        return;
+
+    for (size_t i = 0; i < CQ_STMT_CACHE; ++i) {
+        if (cache->entries[i].stmt != NULL)
+            mysql_stmt_close(cache->entries[i].stmt);
+        free(cache->entries[i].sql);
+
+        cache->entries[i].stmt = NULL;
+        cache->entries[i].sql = NULL;
+        cache->entries[i].used = 0;
+    }
+}
+
+void cq_free_stmt_cache(struct cq_stmt_cache *cache)
+{
+    cq_stmt_cache_clear(cache);
+    free(cache);
+}
+
+static MYSQL_STMT *stmt_get(struct dbconn *con, const char *sql)
+{
+    struct cq_stmt_cache *cache = con->stmts;
+    size_t victim = 0;
+
+    ++cache->tick;
+    for (size_t i = 0; i < CQ_STMT_CACHE; ++i) {
+        if (cache->entries[i].sql != NULL
+                && !strcmp(cache->entries[i].sql, sql)) {
+            cache->entries[i].used = cache->tick;
+            return cache->entries[i].stmt;
+        }
+
+        if (cache->entries[i].used < cache->entries[victim].used)
+            victim = i;
+    }
+
+    size_t len = strlen(sql);
+    char *key = malloc(len + 1);
+    if (key == NULL)
+        return NULL;
+    memcpy(key, sql, len + 1);
+
+    MYSQL_STMT *stmt = mysql_stmt_init(con->con);
+    if (stmt == NULL) {
+        free(key);
+        return NULL;
+    }
+
+    if (mysql_stmt_prepare(stmt, sql, len)) {
+        mysql_stmt_close(stmt);
+        free(key);
+        return NULL;
+    }
+
+    /* evict the least recently used statement */
+    if (cache->entries[victim].stmt != NULL)
+        mysql_stmt_close(cache->entries[victim].stmt);
+    free(cache->entries[victim].sql);
+
+    cache->entries[victim].sql = key;
+    cache->entries[victim].stmt = stmt;
+    cache->entries[victim].used = cache->tick;
+    return stmt;
+}
+
+static void bind_string(MYSQL_BIND *bind, const char *value, size_t len)
+{
+    bind->buffer_type = MYSQL_TYPE_STRING;
+    bind->buffer = (void *) value;
+    bind->buffer_length = len;
+}
+
+/* binds numbers in their binary form where the row keeps one */
+static void bind_cell(MYSQL_BIND *bind, const struct drow *row, size_t i)
+{
+    memset(bind, 0, sizeof(MYSQL_BIND));
+
+    if (cq_drow_is_null(row, i)) {
+        bind->buffer_type = MYSQL_TYPE_NULL;
+        return;
+    }
+
+    if (row->natives != NULL && row->lengths[i]) {
+        switch (row->types[i]) {
+        case CQ_INT:
+        case CQ_UINT:
+            bind->buffer_type = MYSQL_TYPE_LONGLONG;
+            bind->buffer = (void *) &row->natives[i];
+            bind->is_unsigned = row->types[i] == CQ_UINT;
+            return;
+
+        case CQ_DOUBLE:
+            bind->buffer_type = MYSQL_TYPE_DOUBLE;
+            bind->buffer = (void *) &row->natives[i].d;
+            return;
+
+        default:
+            break;
+        }
+    }
+
+    bind_string(bind, row->values[i], row->lengths[i]);
+}
+
+/* discards any result sets a statement produced, such as those of a CALL */
+static int stmt_drain(MYSQL_STMT *stmt)
+{
+    int rc;
+
+    do {
+        if (mysql_stmt_field_count(stmt) > 0) {
+            if (mysql_stmt_store_result(stmt))
+                return 1;
+            mysql_stmt_free_result(stmt);
+        }
+    } while ((rc = mysql_stmt_next_result(stmt)) == 0);
+
+    return rc > 0;
+}
+
+bool cq_can_prepare(const struct dbconn *con, size_t fieldc,
+        char * const *values)
+{
+    if (!con->prepared || con->stmts == NULL)
+        return false;
+
+    /* values prefixed with '\\' are SQL to be inlined and cannot be bound */
+    for (size_t i = 0; i < fieldc; ++i)
+        if (values[i][0] == '\\')
+            return false;
+
+    return true;
+}
+
+bool cq_can_prepare_rows(const struct dbconn *con, const struct drow *start,
+        size_t count)
+{
+    if (!con->prepared || con->stmts == NULL)
+        return false;
+
+    /* only the rows to be sent are checked, so that the workers of
+       cq_insert_parallel() each scan their own range */
+    const struct drow *r = start;
+    for (size_t n = 0; n < count; ++n, r = r->next)
+        if (!cq_can_prepare(con, r->fieldc, r->values))
+            return false;
+
+    return true;
+}
+
+/* the bytes a row adds to an execute packet, counting a length or type byte
+   for each value */
+static size_t bound_size(const struct drow *row)
+{
+    size_t bytes = row->fieldc;
+
+    for (size_t i = 0; i < row->fieldc; ++i)
+        bytes += row->lengths[i];
+    return bytes;
+}
+
+/* the number of rows from r to send next: as many as fit in the query length,
+   a longer row alone */
+static size_t batch_rows(const struct drow *r, size_t left, size_t most,
+        size_t qlen)
+{
+    size_t n = 0, bytes = 0;
+
+    for (; n < left && n < most; ++n, r = r->next) {
+        bytes += bound_size(r);
+        if (n && bytes > qlen)
+            break;
+    }
+
+    /* each count of rows is its own statement, so rounding down to a power
+       of two keeps the few that are prepared in the cache */
+    size_t pow = 1;
+    while (pow * 2 <= n)
+        pow *= 2;
+    return pow;
+}
+
+int cq_prep_insert(struct dbconn *con, const char *table,
+        const struct dlist *list, const struct drow *start, size_t count,
+        size_t base, unsigned long long *affected)
+{
+    size_t qlen = cq_qlen(con);
+    int rc = 0;
+    struct cq_buf columns, query;
+    size_t most, first = base;
+
+    if (list->fieldc == 0)
+        return 100;
+
+    most = CQ_STMT_MAXPARAMS / list->fieldc;
+    if (con->batch && con->batch < most)
+        most = con->batch;
+
+    cq_buf_init(&columns);
+    rc = cq_dlist_fields_to_utf8(con, &columns, *list);
+    if (rc) {
+        cq_buf_free(&columns);
+        return 100;
+    }
+
+    /* grown to the largest batch sent */
+    MYSQL_BIND *bind = NULL;
+    size_t bindcap = 0;
+
+    cq_buf_init(&query);
+
+    const struct drow *r = start;
+    size_t left = count;
+    while (left) {
+        size_t n = batch_rows(r, left, most, qlen);
+
+        if (n * list->fieldc > bindcap) {
+            MYSQL_BIND *grown = realloc(bind,
+                    n * list->fieldc * sizeof(MYSQL_BIND));
+            if (grown == NULL) {
+                rc = -2;
+                break;
+            }
+
+            bind = grown;
+            bindcap = n * list->fieldc;
+        }
+
+        cq_buf_reset(&query);
+        rc = !cq_buf_printf(&query, "INSERT INTO %s(%s) VALUES", table,
+                columns.data);
+        for (size_t i = 0; i < n && !rc; ++i) {
+            rc = !cq_buf_puts(&query, i ? ",(" : "(");
+            for (size_t j = 0; j < list->fieldc && !rc; ++j)
+                rc = !cq_buf_puts(&query, j ? ",?" : "?");
+            if (!rc)
+                rc = !cq_buf_puts(&query, ")");
+        }
+        if (rc) {
+            rc = -3;
+            break;
+        }
+
+        MYSQL_STMT *stmt = stmt_get(con, query.data);
+        if (stmt == NULL) {
+            rc = 102;
+            break;
+        }
+
+        size_t bytes = 0;
+        for (size_t i = 0; i < n; ++i, r = r->next) {
+            for (size_t j = 0; j < list->fieldc; ++j) {
+                bind_cell(&bind[i*list->fieldc + j], r, j);
+                bytes += r->lengths[j];
+            }
+        }
+
+        if (cq_count_query(con, mysql_stmt_bind_param(stmt, bind)
+                || mysql_stmt_execute(stmt))) {
+            rc = 201;
+            break;
+        }
+
+        unsigned long long done = mysql_stmt_affected_rows(stmt);
+        if (affected != NULL)
+            *affected += done;
+        if (con->on_batch != NULL)
+            con->on_batch(first, n, done, con->batch_data);
+
+        rc = cq_txn_sent(con, n, bytes);
+        if (rc)
+            break;
+
+        first += n;
+        left -= n;
+    }
+
+    cq_buf_free(&query);
+    free(bind);
+    cq_buf_free(&columns);
+    return rc;
+}
+
+static bool is_key(const size_t *keys, size_t keyc, size_t index)
+{
+    for (size_t k = 0; k < keyc; ++k)
+        if (keys[k] == index)
+            return true;
+    return false;
+}
+
+int cq_prep_update(struct dbconn *con, const char *table,
+        const struct dlist *list, const size_t *keys, size_t keyc)
+{
+    int rc;
+    size_t first = 0;
+    struct cq_buf query;
+
+    MYSQL_BIND *bind = calloc(list->fieldc, sizeof(MYSQL_BIND));
+    if (bind == NULL)
+        return -2;
+
+    cq_buf_init(&query);
+    rc = !cq_buf_printf(&query, "UPDATE %s SET ", table);
+    bool firstcol = true;
+    for (size_t i = 0; i < list->fieldc && !rc; ++i) {
+        if (is_key(keys, keyc, i))
+            continue;
+
+        rc = !cq_buf_printf(&query, "%s%s=?", firstcol ? "" : ",",
+                list->fieldnames[i]);
+        firstcol = false;
+    }
+    for (size_t k = 0; k < keyc && !rc; ++k)
+        rc = !cq_buf_printf(&query, " %s %s=?", k ? "AND" : "WHERE",
+                list->fieldnames[keys[k]]);
+    if (rc) {
+        free(bind);
+        cq_buf_free(&query);
+        return -1;
+    }
+
+    MYSQL_STMT *stmt = stmt_get(con, query.data);
+    cq_buf_free(&query);
+    if (stmt == NULL) {
+        free(bind);
+        return 102;
+    }
+
+    rc = 0;
+    for (const struct drow *r = list->first; r != NULL; r = r->next) {
+        size_t n = 0, bytes = 0;
+        for (size_t i = 0; i < list->fieldc; ++i) {
+            if (!is_key(keys, keyc, i))
+                bind_cell(&bind[n++], r, i);
+            bytes += r->lengths[i];
+        }
+        for (size_t k = 0; k < keyc; ++k)
+            bind_cell(&bind[n++], r, keys[k]);
+
+        if (cq_count_query(con, mysql_stmt_bind_param(stmt, bind)
+                || mysql_stmt_execute(stmt))) {
+            rc = 201;
+            break;
+        }
+
+        if (con->on_batch != NULL)
+            con->on_batch(first, 1, mysql_stmt_affected_rows(stmt),
+                    con->batch_data);
+
+        rc = cq_txn_sent(con, 1, bytes);
+        if (rc)
+            break;
+        ++first;
+    }
+
+    free(bind);
+    return rc;
+}
+
+int cq_prep_proc(struct dbconn *con, const char *proc, char * const *args,
+        size_t num_args)
+{
+    int rc;
+    struct cq_buf query;
+
+    cq_buf_init(&query);
+    rc = !cq_buf_printf(&query, "CALL %s(", proc);
+    for (size_t i = 0; i < num_args && !rc; ++i)
+        rc = !cq_buf_puts(&query, i ? ",?" : "?");
+    if (rc || !cq_buf_puts(&query, ")")) {
+        cq_buf_free(&query);
+        return -1;
+    }
+
+    MYSQL_STMT *stmt = stmt_get(con, query.data);
+    cq_buf_free(&query);
+    if (stmt == NULL)
+        return 101;
+
+    MYSQL_BIND *bind = NULL;
+    if (num_args) {
+        bind = calloc(num_args, sizeof(MYSQL_BIND));
+        if (bind == NULL)
+            return -2;
+
+        for (size_t i = 0; i < num_args; ++i)
+            bind_string(&bind[i], args[i], strlen(args[i]));
+
+        if (mysql_stmt_bind_param(stmt, bind)) {
+            free(bind);
+            return 201;
+        }
+    }
+
+    rc = cq_count_query(con, mysql_stmt_execute(stmt) || stmt_drain(stmt));
+    free(bind);
+    return rc ? 201 : 0;
+}
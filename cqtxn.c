@@ -0,0 +1,104 @@
+/*
+ *  cquel - MySQL C API wrapper with dynamic data structures
+ *  Copyright (C) 2014 Delwink, LLC
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as published by
+ *  the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <mysql.h>
+
+#include "cquel.h"
+#include "cqstatic.h"
+
+static void report(const struct dbconn *con, const struct cq_txn *txn)
+{
+    if (con->committed != NULL)
+        *con->committed = txn->committed;
+}
+
+static int txn_open(struct dbconn *con, struct cq_txn *txn)
+{
+    txn->rows = 0;
+    txn->bytes = 0;
+    txn->open = !cq_query(con, "START TRANSACTION");
+    return txn->open ? 0 : 201;
+}
+
+static int txn_close(struct dbconn *con, struct cq_txn *txn, bool commit)
+{
+    txn->open = false;
+
+    if (commit && !cq_query(con, "COMMIT")) {
+        txn->committed += txn->rows;
+        report(con, txn);
+        return 0;
+    }
+
+    /* a failed COMMIT leaves the transaction to be undone */
+    cq_query(con, "ROLLBACK");
+    return commit ? 201 : 0;
+}
+
+int cq_txn_begin(struct dbconn *con, struct cq_txn *txn)
+{
+    txn->open = false;
+    txn->rows = 0;
+    txn->bytes = 0;
+    txn->committed = 0;
+
+    con->txn = txn;
+    report(con, txn);
+
+    if (con->commit_rows == 0 && con->commit_bytes == 0)
+        return 0;
+
+    return txn_open(con, txn);
+}
+
+int cq_txn_sent(struct dbconn *con, size_t rows, size_t bytes)
+{
+    struct cq_txn *txn = con->txn;
+    if (txn == NULL)
+        return 0;
+
+    /* without a transaction, every statement commits as it is run */
+    if (!txn->open) {
+        txn->committed += rows;
+        report(con, txn);
+        return 0;
+    }
+
+    txn->rows += rows;
+    txn->bytes += bytes;
+
+    if ((con->commit_rows && txn->rows >= con->commit_rows)
+            || (con->commit_bytes && txn->bytes >= con->commit_bytes)) {
+        int rc = txn_close(con, txn, true);
+        return rc ? rc : txn_open(con, txn);
+    }
+
+    return 0;
+}
+
+int cq_txn_end(struct dbconn *con, int rc)
+{
+    struct cq_txn *txn = con->txn;
+    con->txn = NULL;
+
+    if (txn == NULL || !txn->open)
+        return rc;
+
+    int end = txn_close(con, txn, !rc);
+    return rc ? rc : end;
+}
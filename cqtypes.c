@@ -0,0 +1,339 @@
+/*
+ *  cquel - MySQL C API wrapper with dynamic data structures
+ *  Copyright (C) 2014 Delwink, LLC
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as published by
+ *  the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <mysql.h>
+
+#include "cquel.h"
+#include "cqstatic.h"
+
+/* longer than any number or time the server sends, DECIMAL(65) included */
+#define CQ_NATIVE_MAXLEN 96
+
+static enum cq_type field_type(const MYSQL_FIELD *field)
+{
+    switch (field->type) {
+    case MYSQL_TYPE_TINY:
+    case MYSQL_TYPE_SHORT:
+    case MYSQL_TYPE_INT24:
+    case MYSQL_TYPE_LONG:
+    case MYSQL_TYPE_LONGLONG:
+    case MYSQL_TYPE_YEAR:
+        return field->flags & UNSIGNED_FLAG ? CQ_UINT : CQ_INT;
+
+    case MYSQL_TYPE_FLOAT:
+    case MYSQL_TYPE_DOUBLE:
+        return CQ_DOUBLE;
+
+    case MYSQL_TYPE_DECIMAL:
+    case MYSQL_TYPE_NEWDECIMAL:
+        return CQ_DECIMAL;
+
+    case MYSQL_TYPE_DATE:
+    case MYSQL_TYPE_NEWDATE:
+    case MYSQL_TYPE_DATETIME:
+    case MYSQL_TYPE_TIMESTAMP:
+    case MYSQL_TYPE_TIME:
+        return CQ_TIME;
+
+    default:
+        return CQ_TEXT;
+    }
+}
+
+int cq_dlist_set_types(struct dlist *list, const MYSQL_FIELD *fields)
+{
+    enum cq_type *types = malloc((list->fieldc ? list->fieldc : 1)
+            * sizeof(enum cq_type));
+    if (types == NULL)
+        return -1;
+
+    for (size_t i = 0; i < list->fieldc; ++i)
+        types[i] = field_type(&fields[i]);
+
+    free(list->types);
+    list->types = types;
+    return 0;
+}
+
+/* a sign, digits with at most one point, then an optional exponent; nothing
+   else may be written into a query unquoted */
+static bool numeric_text(const char *s, size_t len)
+{
+    size_t i = 0, digits = 0;
+
+    if (i < len && (s[i] == '-' || s[i] == '+'))
+        ++i;
+    for (; i < len && isdigit((unsigned char) s[i]); ++i)
+        ++digits;
+    if (i < len && s[i] == '.')
+        for (++i; i < len && isdigit((unsigned char) s[i]); ++i)
+            ++digits;
+    if (!digits)
+        return false;
+
+    if (i < len && (s[i] == 'e' || s[i] == 'E')) {
+        if (++i < len && (s[i] == '-' || s[i] == '+'))
+            ++i;
+
+        size_t start = i;
+        while (i < len && isdigit((unsigned char) s[i]))
+            ++i;
+        if (i == start)
+            return false;
+    }
+
+    return i == len;
+}
+
+static size_t read_uint(const char **s, size_t max, unsigned long *out)
+{
+    size_t n = 0;
+
+    *out = 0;
+    while (n < max && isdigit((unsigned char) **s)) {
+        *out = *out * 10 + (unsigned long) (**s - '0');
+        ++*s;
+        ++n;
+    }
+
+    return n;
+}
+
+static bool parse_time(const char *s, struct cq_time *t)
+{
+    const char *p = s;
+    unsigned long a, b, c;
+
+    memset(t, 0, sizeof(struct cq_time));
+
+    /* DATE, DATETIME and TIMESTAMP begin with the date */
+    if (read_uint(&p, 4, &a) == 4 && *p == '-') {
+        ++p;
+        if (read_uint(&p, 2, &b) != 2 || *p++ != '-'
+                || read_uint(&p, 2, &c) != 2)
+            return false;
+
+        t->year = a;
+        t->month = b;
+        t->day = c;
+
+        if (*p == '\0')
+            return true;
+        if (*p != ' ' && *p != 'T')
+            return false;
+        s = p + 1;
+    }
+
+    p = s;
+    if (*p == '-') {
+        t->neg = true;
+        ++p;
+    }
+
+    /* TIME runs to 838 hours */
+    if (!read_uint(&p, 3, &a) || *p++ != ':' || read_uint(&p, 2, &b) != 2
+            || *p++ != ':' || read_uint(&p, 2, &c) != 2)
+        return false;
+
+    t->hour = a;
+    t->minute = b;
+    t->second = c;
+
+    if (*p == '.') {
+        ++p;
+        size_t n = read_uint(&p, 6, &a);
+        if (n == 0)
+            return false;
+
+        while (n++ < 6)
+            a *= 10;
+        t->usec = a;
+    }
+
+    return *p == '\0';
+}
+
+int cq_parse_native(enum cq_type type, const char *value, size_t len,
+        union cq_native *out)
+{
+    char s[CQ_NATIVE_MAXLEN];
+    char *end;
+
+    memset(out, 0, sizeof(union cq_native));
+    if (type == CQ_TEXT)
+        return 0;
+
+    /* values may hold null bytes, which no number or time does */
+    if (len == 0 || len >= sizeof s || memchr(value, '\0', len))
+        return 1;
+    memcpy(s, value, len);
+    s[len] = '\0';
+
+    if (type == CQ_TIME)
+        return !parse_time(s, &out->t);
+
+    if (!numeric_text(s, len))
+        return 1;
+
+    errno = 0;
+    switch (type) {
+    case CQ_INT:
+        out->i = strtoll(s, &end, 10);
+        break;
+
+    case CQ_UINT:
+        /* strtoull() would wrap a negative value around */
+        if (s[0] == '-')
+            return 1;
+        out->u = strtoull(s, &end, 10);
+        break;
+
+    default:
+        out->d = strtod(s, &end);
+        break;
+    }
+
+    return errno == ERANGE || *end != '\0';
+}
+
+void cq_drow_mark_null(struct drow *row, size_t index, bool null)
+{
+    unsigned char bit = 1 << index % 8;
+
+    if (null)
+        row->nulls[index / 8] |= bit;
+    else
+        row->nulls[index / 8] &= ~bit;
+}
+
+bool cq_drow_is_null(const struct drow *row, size_t index)
+{
+    if (row == NULL || index >= row->fieldc)
+        return false;
+
+    return row->nulls[index / 8] & 1 << index % 8;
+}
+
+int cq_drow_set_null(struct drow *row, size_t index)
+{
+    int rc = cq_drow_set_value(row, index, NULL, 0);
+    if (rc)
+        return rc;
+
+    cq_drow_mark_null(row, index, true);
+    return 0;
+}
+
+/* reads the binary form of a value kept by a typed row, parsing the text of
+   any other; a DECIMAL is kept as a double */
+static int get_native(const struct drow *row, size_t index,
+        enum cq_type type, union cq_native *out)
+{
+    if (row == NULL || out == NULL)
+        return 1;
+    if (index >= row->fieldc)
+        return 2;
+    if (cq_drow_is_null(row, index))
+        return 3;
+
+    if (row->natives != NULL && (row->types[index] == type
+            || (type == CQ_DOUBLE && row->types[index] == CQ_DECIMAL))) {
+        *out = row->natives[index];
+        return 0;
+    }
+
+    if (cq_parse_native(type, row->values[index], row->lengths[index], out))
+        return 4;
+    return 0;
+}
+
+int cq_drow_get_int(const struct drow *row, size_t index, long long *out)
+{
+    union cq_native v;
+
+    int rc = get_native(row, index, CQ_INT, &v);
+    if (!rc)
+        *out = v.i;
+    return rc;
+}
+
+int cq_drow_get_uint(const struct drow *row, size_t index,
+        unsigned long long *out)
+{
+    union cq_native v;
+
+    int rc = get_native(row, index, CQ_UINT, &v);
+    if (!rc)
+        *out = v.u;
+    return rc;
+}
+
+int cq_drow_get_double(const struct drow *row, size_t index, double *out)
+{
+    union cq_native v;
+
+    int rc = get_native(row, index, CQ_DOUBLE, &v);
+    if (!rc)
+        *out = v.d;
+    return rc;
+}
+
+int cq_drow_get_time(const struct drow *row, size_t index,
+        struct cq_time *out)
+{
+    union cq_native v;
+
+    int rc = get_native(row, index, CQ_TIME, &v);
+    if (!rc)
+        *out = v.t;
+    return rc;
+}
+
+bool cq_buf_cell(struct cq_buf *buf, struct dbconn *con,
+        const struct dlist *list, const struct drow *row, size_t index)
+{
+    const char *value = row->values[index];
+    size_t len = row->lengths[index];
+
+    if (cq_drow_is_null(row, index))
+        return cq_buf_puts(buf, "NULL");
+
+    /* without types, and for inlined SQL, the value decides for itself */
+    if (list->types == NULL || (len && value[0] == '\\'))
+        return cq_buf_value(buf, con, value, len, true);
+
+    switch (list->types[index]) {
+    case CQ_INT:
+    case CQ_UINT:
+    case CQ_DOUBLE:
+    case CQ_DECIMAL:
+        /* rows made outside the list were never checked against its types */
+        if (numeric_text(value, len))
+            return cq_buf_append(buf, value, len);
+        break;
+
+    default:
+        break;
+    }
+
+    return cq_buf_string(buf, con, value, len);
+}
@@ -24,13 +24,13 @@
 #include "cquel.h"
 #include "cqstatic.h"
 
-size_t CQ_QLEN = 0;
-size_t CQ_FMAXLEN = 0;
-
 void cq_init(size_t qlen, size_t fmaxlen)
 {
-    CQ_QLEN = qlen;
-    CQ_FMAXLEN = fmaxlen;
+    struct cq_ctx *ctx = cq_ctx_get(NULL);
+
+    ctx->qlen = qlen;
+    ctx->fmaxlen = fmaxlen;
+    cq_thread_init();
 }
 
 struct dbconn cq_new_connection(const char *host, const char *user,
@@ -41,27 +41,59 @@ struct dbconn cq_new_connection(const char *host, const char *user,
         .host = host,
         .user = user,
         .passwd = passwd,
-        .database = database
+        .database = database,
+        .pool = NULL,
+        .batch = 0,
+        .on_batch = NULL,
+        .batch_data = NULL,
+        .prepared = false,
+        .stmts = NULL,
+        .ctx = NULL,
+        .commit_rows = 0,
+        .commit_bytes = 0,
+        .committed = NULL,
+        .txn = NULL
     };
     return out;
 }
 
 int cq_connect(struct dbconn *con)
 {
+    if (cq_thread_init())
+        return -2;
+
     con->con = mysql_init(NULL);
+    if (con->con == NULL)
+        return -1;
+
+#ifdef MARIADB_BASE_VERSION
+    /* lets the connection also serve the async functions */
+    mysql_options(con->con, MYSQL_OPT_NONBLOCK, 0);
+#endif
+
+    /* LOCAL INFILE only ever reads the rows given to cq_load_dlist() */
+    unsigned int local = 1;
+    mysql_options(con->con, MYSQL_OPT_LOCAL_INFILE, &local);
+    cq_load_attach(con, NULL);
 
     if (mysql_real_connect(con->con, con->host, con->user, con->passwd,
             con->database, 0, NULL, CLIENT_MULTI_STATEMENTS) == NULL) {
+        mysql_close(con->con);
+        con->con = NULL;
         return 1;
     }
 
     con->isopen = true;
+    con->stmts = cq_new_stmt_cache();
+    atomic_fetch_add(&cq_ctx_get(con->ctx)->connects, 1);
 
     return 0;
 }
 
 void cq_close_connection(struct dbconn *con)
 {
+    cq_free_stmt_cache(con->stmts);
+    con->stmts = NULL;
     mysql_close(con->con);
     con->isopen = false;
 }
@@ -69,12 +101,22 @@ void cq_close_connection(struct dbconn *con)
 int cq_test(struct dbconn con)
 {
     int rc;
+    bool owned;
+
+    rc = cq_acquire(&con, &owned);
+    if (rc)
+        return rc;
 
-    rc = cq_connect(&con);
-    cq_close_connection(&con);
+    if (!owned)
+        rc = mysql_ping(con.con);
+
+    cq_release(&con, owned);
     return rc;
 }
 
+/* shared by every empty value so that it need not be allocated */
+static char empty_value[1];
+
 struct drow *cq_new_drow(size_t fieldc)
 {
     struct drow *row = malloc(sizeof(struct drow));
@@ -88,23 +130,25 @@ struct drow *cq_new_drow(size_t fieldc)
         return NULL;
     }
 
-    int rc = 0;
-    size_t i;
-    for (i = 0; i < fieldc; ++i) {
-        if ((row->values[i] = calloc(CQ_FMAXLEN, sizeof(char))) == NULL) {
-            rc = -1;
-        }
+    if ((row->lengths = calloc(fieldc, sizeof(size_t))) == NULL) {
+        free(row->values);
+        free(row);
+        return NULL;
     }
 
-    if (rc) {
-        for (size_t j = 0; j < i; ++j) {
-            free(row->values[j]);
-        }
+    if ((row->nulls = calloc(fieldc / 8 + 1, 1)) == NULL) {
+        free(row->lengths);
         free(row->values);
         free(row);
         return NULL;
     }
 
+    for (size_t i = 0; i < fieldc; ++i)
+        row->values[i] = empty_value;
+
+    row->natives = NULL;
+    row->types = NULL;
+    row->arena = NULL;
     row->prev = NULL;
     row->next = NULL;
     return row;
@@ -112,14 +156,72 @@ struct drow *cq_new_drow(size_t fieldc)
 
 void cq_free_drow(struct drow *row)
 {
-    if (row == NULL)
+    /* rows from an arena are freed along with their list */
+    if (row == NULL || row->arena != NULL)
         return;
     for (size_t i = 0; i < row->fieldc; ++i)
-        free(row->values[i]);
+        if (row->values[i] != empty_value)
+            free(row->values[i]);
     free(row->values);
+    free(row->lengths);
+    free(row->nulls);
+    free(row->natives);
     free(row);
 }
 
+int cq_drow_set_value(struct drow *row, size_t index, const char *value,
+        size_t len)
+{
+    if (row == NULL)
+        return 1;
+    if (index >= row->fieldc)
+        return 2;
+    if (value == NULL && len)
+        return 3;
+
+    /* typed rows keep the binary form of each value alongside its text */
+    union cq_native native;
+    if (row->types != NULL && len && value[0] != '\\'
+            && cq_parse_native(row->types[index], value, len, &native))
+        return 4;
+
+    char *dest = row->values[index];
+    if (len == 0) {
+        dest = empty_value;
+    } else if (dest == empty_value || row->lengths[index] < len) {
+        /* a buffer is only replaced when the new value does not fit */
+        if (row->arena != NULL)
+            dest = cq_arena_alloc(row->arena, len + 1);
+        else
+            dest = malloc(len + 1);
+
+        if (dest == NULL)
+            return -1;
+    }
+
+    if (dest != row->values[index] && row->arena == NULL
+            && row->values[index] != empty_value)
+        free(row->values[index]);
+
+    if (len) {
+        memcpy(dest, value, len);
+        dest[len] = '\0';
+    }
+
+    row->values[index] = dest;
+    row->lengths[index] = len;
+    cq_drow_mark_null(row, index, false);
+
+    if (row->natives != NULL) {
+        if (len && value[0] != '\\')
+            row->natives[index] = native;
+        else
+            memset(&row->natives[index], 0, sizeof(union cq_native));
+    }
+
+    return 0;
+}
+
 int cq_drow_set(struct drow *row, char * const *values)
 {
     if (row == NULL)
@@ -127,20 +229,46 @@ int cq_drow_set(struct drow *row, char * const *values)
     if (values == NULL)
         return 2;
 
-    int rc = 0;
-    size_t i;
-    for (i = 0; i < row->fieldc; ++i) {
-        if (strlen(values[i]) >= CQ_FMAXLEN) {
-            rc = -1;
-            break;
+    for (size_t i = 0; i < row->fieldc; ++i)
+        if (cq_drow_set_value(row, i, values[i], strlen(values[i])))
+            return -1;
+
+    return 0;
+}
+
+/* points an arena row at values owned by the list's result set */
+static void drow_adopt(struct drow *row, char * const *values,
+        const unsigned long *lengths)
+{
+    for (size_t i = 0; i < row->fieldc; ++i) {
+        if (values[i] == NULL || lengths[i] == 0) {
+            row->values[i] = empty_value;
+            row->lengths[i] = 0;
+        } else {
+            row->values[i] = values[i];
+            row->lengths[i] = lengths[i];
         }
-        strcpy(row->values[i], values[i]);
+
+        if (values[i] == NULL)
+            cq_drow_mark_null(row, i, true);
+
+        /* only the columns which have a binary form are parsed; the server's
+           text always parses, and a failure leaves zero */
+        if (row->natives != NULL && values[i] != NULL
+                && row->types[i] != CQ_TEXT)
+            cq_parse_native(row->types[i], values[i], lengths[i],
+                    &row->natives[i]);
     }
+}
 
-    if (rc) {
-        for (size_t j = 0; j < i; ++j)
-            free(row->values[j]);
-        return -1;
+int cq_drow_set_lens(struct drow *row, char * const *values,
+        const unsigned long *lengths)
+{
+    for (size_t i = 0; i < row->fieldc; ++i) {
+        int rc = values[i] == NULL ? cq_drow_set_null(row, i)
+                : cq_drow_set_value(row, i, values[i], lengths[i]);
+        if (rc)
+            return -1;
     }
 
     return 0;
@@ -149,6 +277,13 @@ int cq_drow_set(struct drow *row, char * const *values)
 struct dlist *cq_new_dlist(size_t fieldc, char * const *fieldnames,
         const char *primkey)
 {
+    return cq_new_dlist_ctx(NULL, fieldc, fieldnames, primkey);
+}
+
+struct dlist *cq_new_dlist_ctx(struct cq_ctx *ctx, size_t fieldc,
+        char * const *fieldnames, const char *primkey)
+{
+    size_t fmaxlen = cq_ctx_get(ctx)->fmaxlen;
     bool hasprim = NULL != primkey;
 
     if (fieldnames == NULL)
@@ -173,11 +308,14 @@ struct dlist *cq_new_dlist(size_t fieldc, char * const *fieldnames,
             break;
         }
 
-        if (strlen(fieldnames[i]) >= CQ_FMAXLEN) {
+        /* without a limit, each name is given just the room it needs */
+        size_t len = strlen(fieldnames[i]);
+        if (fmaxlen && len >= fmaxlen) {
             rc = -1;
             break;
         }
-        list->fieldnames[i] = calloc(CQ_FMAXLEN, sizeof(char));
+        list->fieldnames[i] = calloc(fmaxlen ? fmaxlen : len + 1,
+                sizeof(char));
         if (list->fieldnames[i] == NULL) {
             rc = -1;
             break;
@@ -192,7 +330,10 @@ struct dlist *cq_new_dlist(size_t fieldc, char * const *fieldnames,
         return NULL;
     }
 
-    list->primkey = calloc(CQ_FMAXLEN, sizeof(char));
+    /* a composite key lists its fields separated by commas */
+    size_t plen = hasprim ? strlen(primkey) + 1 : 0;
+    list->primkey = calloc(plen > fmaxlen ? plen : fmaxlen ? fmaxlen : 1,
+            sizeof(char));
     if (list->primkey == NULL) {
         for (size_t j = 0; j < i; ++j)
             free(list->fieldnames[j]);
@@ -203,24 +344,114 @@ struct dlist *cq_new_dlist(size_t fieldc, char * const *fieldnames,
     if (hasprim)
         strcpy(list->primkey, primkey);
 
+    list->types = NULL;
+    list->arena = NULL;
+    list->heaprows = 0;
+    list->rowc = 0;
+    list->index = NULL;
+    list->indexcap = 0;
+    list->indexed = true;
+    list->keys = NULL;
+    list->result = NULL;
     list->first = NULL;
     list->last = NULL;
+
+    /* lookups fall back to scanning the names if the map cannot be built */
+    list->fieldmap = NULL;
+    cq_fieldmap_build(list);
     return list;
 }
 
-size_t cq_dlist_size(const struct dlist *list)
+int cq_dlist_use_arena(struct dlist *list)
 {
     if (list == NULL)
+        return 1;
+    if (list->arena != NULL)
         return 0;
-    size_t count = 0;
-    struct drow *row = list->first;
 
-    while (row != NULL) {
-        ++count;
-        row = row->next;
+    list->arena = cq_new_arena();
+    if (list->arena == NULL)
+        return -1;
+
+    /* rows added so far still need to be freed one by one */
+    list->heaprows = cq_dlist_size(list);
+    return 0;
+}
+
+/* rows of a list whose columns are all text have no binary forms to keep */
+static bool has_natives(const struct dlist *list)
+{
+    if (list->types == NULL)
+        return false;
+
+    for (size_t i = 0; i < list->fieldc; ++i)
+        if (list->types[i] != CQ_TEXT)
+            return true;
+    return false;
+}
+
+struct drow *cq_dlist_new_drow(struct dlist *list)
+{
+    if (list == NULL)
+        return NULL;
+    if (list->arena == NULL) {
+        struct drow *row = cq_new_drow(list->fieldc);
+        if (row == NULL)
+            return NULL;
+
+        row->types = list->types;
+        if (!has_natives(list))
+            return row;
+
+        row->natives = calloc(list->fieldc, sizeof(union cq_native));
+        if (row->natives == NULL) {
+            cq_free_drow(row);
+            return NULL;
+        }
+        return row;
+    }
+
+    size_t fieldc = list->fieldc;
+    struct drow *row = cq_arena_alloc(list->arena, sizeof(struct drow));
+    if (row == NULL)
+        return NULL;
+
+    row->values = cq_arena_alloc(list->arena, fieldc * sizeof(char *));
+    if (row->values == NULL)
+        return NULL;
+
+    row->lengths = cq_arena_calloc(list->arena, fieldc, sizeof(size_t));
+    if (row->lengths == NULL)
+        return NULL;
+
+    row->nulls = cq_arena_calloc(list->arena, fieldc / 8 + 1, 1);
+    if (row->nulls == NULL)
+        return NULL;
+
+    row->natives = NULL;
+    row->types = list->types;
+    if (has_natives(list)) {
+        row->natives = cq_arena_calloc(list->arena, fieldc,
+                sizeof(union cq_native));
+        if (row->natives == NULL)
+            return NULL;
     }
 
-    return count;
+    for (size_t i = 0; i < fieldc; ++i)
+        row->values[i] = empty_value;
+
+    row->fieldc = fieldc;
+    row->arena = list->arena;
+    row->prev = NULL;
+    row->next = NULL;
+    return row;
+}
+
+size_t cq_dlist_size(const struct dlist *list)
+{
+    if (list == NULL)
+        return 0;
+    return list->rowc;
 }
 
 void cq_free_dlist(struct dlist *list)
@@ -230,17 +461,78 @@ void cq_free_dlist(struct dlist *list)
     for (size_t i = 0; i < list->fieldc; ++i)
         free(list->fieldnames[i]);
     free(list->fieldnames);
-    struct drow *row = list->first;
-    struct drow *next;
-    do {
-        next = row->next;
-        cq_free_drow(row);
-    } while ((row = next) != NULL);
+    free(list->primkey);
+    free(list->types);
+    free(list->fieldmap);
+
+    /* an arena holding every row is released a chunk at a time */
+    if (list->arena == NULL || list->heaprows) {
+        struct drow *row = list->first;
+        while (row != NULL) {
+            struct drow *next = row->next;
+            cq_free_drow(row);
+            row = next;
+        }
+    }
+
+    cq_free_arena(list->arena);
+    if (list->result != NULL)
+        mysql_free_result(list->result);
+    free(list->index);
+    cq_free_keyindex(list->keys);
     free(list);
 }
 
+static int dlist_reindex(struct dlist *list)
+{
+    if (list->rowc > list->indexcap) {
+        struct drow **index = realloc(list->index,
+                list->rowc * sizeof(struct drow *));
+        if (index == NULL)
+            return -1;
+
+        list->index = index;
+        list->indexcap = list->rowc;
+    }
+
+    size_t i = 0;
+    for (struct drow *row = list->first; row != NULL; row = row->next)
+        list->index[i++] = row;
+
+    list->indexed = true;
+    return 0;
+}
+
 void cq_dlist_add(struct dlist *list, struct drow *row)
 {
+    if (list->arena != NULL && row->arena == NULL)
+        ++list->heaprows;
+
+    /* a stale index is rebuilt here rather than by cq_dlist_at(), which must
+       not write to a list other threads may be reading; if it cannot grow, it
+       is tried again on the next add */
+    if (!list->indexed)
+        dlist_reindex(list);
+    if (list->indexed && list->rowc == list->indexcap) {
+        size_t cap = list->indexcap ? list->indexcap * 2 : 64;
+        struct drow **index = realloc(list->index, cap * sizeof(struct drow *));
+        if (index != NULL) {
+            list->index = index;
+            list->indexcap = cap;
+        } else {
+            list->indexed = false;
+        }
+    }
+    if (list->indexed)
+        list->index[list->rowc] = row;
+    ++list->rowc;
+
+    /* without its key index the list falls back to scanning */
+    if (list->keys != NULL && cq_keyindex_add(list->keys, row)) {
+        cq_free_keyindex(list->keys);
+        list->keys = NULL;
+    }
+
     if (list->last == NULL) {
         list->first = row;
         list->last = row;
@@ -253,25 +545,35 @@ void cq_dlist_add(struct dlist *list, struct drow *row)
     }
 }
 
+static int drow_copy_value(struct drow *dest, const struct drow *src,
+        size_t index)
+{
+    if (cq_drow_is_null(src, index))
+        return cq_drow_set_null(dest, index);
+
+    return cq_drow_set_value(dest, index, src->values[index],
+            src->lengths[index]);
+}
+
 struct dlist *cq_dlist_append(struct dlist **dest, const struct dlist *src)
 {
 	if (!dest || !*dest || !src || dlist_meta_cmp(*dest, src) )
 		return NULL;
 
 	struct drow *copy = NULL;
-	struct drow *fallback = src->last;
+	struct drow *fallback = (*dest)->last;
 	bool error = false;
 
 	for (struct drow *iter = src->first; iter; iter=iter->next) {
-		if (NULL == (copy = cq_new_drow(src->fieldc)) ) {
+		if (NULL == (copy = cq_dlist_new_drow(*dest)) ) {
 			error = true;
 			break;
 		}
 
-		if (cq_drow_set(copy, iter->values)) {
-			error = true;
+		for (size_t i = 0; i < src->fieldc && !error; ++i)
+			error = drow_copy_value(copy, iter, i);
+		if (error)
 			break;
-		}
 
 		cq_dlist_add(*dest, copy);
 	}
@@ -280,11 +582,11 @@ struct dlist *cq_dlist_append(struct dlist **dest, const struct dlist *src)
 		if (copy)
 			cq_free_drow(copy);
 
-		for (struct drow *iter=fallback; iter; iter=iter->next) {
-			cq_free_drow(iter);
-		}
+		/* drop the rows copied so far, leaving dest as it was */
+		while ((*dest)->last != fallback)
+			cq_dlist_remove(*dest, (*dest)->last);
 
-		fallback->next = NULL;
+		return NULL;
 	}
 
 	return *dest;
@@ -311,28 +613,28 @@ void cq_dlist_remove(struct dlist *list, struct drow *row)
         before->next = after;
     }
 
+    /* removing the last row is the only case that keeps the index valid */
+    if (list->last != row->prev || row->next != NULL)
+        list->indexed = false;
+    --list->rowc;
+
+    if (list->keys != NULL)
+        cq_keyindex_remove(list->keys, row);
+
+    if (list->arena != NULL && row->arena == NULL)
+        --list->heaprows;
     cq_free_drow(row);
 }
 
 int cq_dlist_remove_field_str(struct dlist *list, const char *field)
 {
     size_t i;
-    bool found = false;
-    char *s;
-    for (i = 0; i < list->fieldc; ++i) {
-        s = list->fieldnames[i];
-        if (!strcmp(s, field)) {
-            found = true;
-            break;
-        }
-    }
 
-    if (found) {
-        cq_dlist_remove_field_at(list, i);
-        return 0;
-    }
+    if (cq_field_to_index(list, field, &i))
+        return 1;
 
-    return 1;
+    cq_dlist_remove_field_at(list, i);
+    return 0;
 }
 
 int cq_dlist_remove_field_at(struct dlist *list, size_t index)
@@ -343,260 +645,517 @@ int cq_dlist_remove_field_at(struct dlist *list, size_t index)
     if (index >= list->fieldc)
         return 2;
 
-    if (!strcmp(list->fieldnames[index], list->primkey)) {
-        free(list->primkey);
-        list->primkey = NULL;
+    /* removing any part of the key leaves the rows without one */
+    size_t *keys = calloc(list->fieldc, sizeof(size_t));
+    if (keys == NULL)
+        return -1;
+    size_t keyc = cq_dlist_keyfields(list, keys);
+    for (size_t i = 0; i < keyc; ++i)
+        if (keys[i] == index)
+            list->primkey[0] = '\0';
+    free(keys);
+
+    if (list->keys != NULL) {
+        size_t pindex = cq_keyindex_field(list->keys);
+
+        if (index == pindex) {
+            cq_free_keyindex(list->keys);
+            list->keys = NULL;
+        } else if (index < pindex) {
+            cq_keyindex_set_field(list->keys, pindex - 1);
+        }
     }
 
     for (struct drow *row = list->first; row != NULL; row = row->next) {
+        if (index >= row->fieldc)
+            continue;
+
+        if (row->arena == NULL && row->values[index] != empty_value)
+            free(row->values[index]);
+
+        --row->fieldc;
         for (size_t i = index; i < row->fieldc; ++i) {
-            if (i == (row->fieldc - 1)) {
-                --row->fieldc;
-                free(row->values[i]);
-            } else {
-                strcpy(row->values[i], row->values[i+1]);
-            }
+            row->values[i] = row->values[i+1];
+            row->lengths[i] = row->lengths[i+1];
+            cq_drow_mark_null(row, i, row->nulls[(i+1) / 8]
+                    & 1 << (i+1) % 8);
+            if (row->natives != NULL)
+                row->natives[i] = row->natives[i+1];
         }
     }
 
+    /* the rows share the list's types, so they are shifted once */
+    free(list->fieldnames[index]);
+    --list->fieldc;
     for (size_t i = index; i < list->fieldc; ++i) {
-        if (i == (list->fieldc - 1)) {
-            --list->fieldc;
-            free(list->fieldnames[i]);
-        } else {
-            strcpy(list->fieldnames[i], list->fieldnames[i+1]);
-        }
+        list->fieldnames[i] = list->fieldnames[i+1];
+        if (list->types != NULL)
+            list->types[i] = list->types[i+1];
     }
 
+    cq_fieldmap_build(list);
     return 0;
 }
 
 struct drow *cq_dlist_at(const struct dlist *list, size_t index)
 {
-    if (list == NULL)
+    if (list == NULL || index >= list->rowc)
         return NULL;
-    for (struct drow *row = list->first; row != NULL; row = row->next)
-        if (index-- == 0)
-            return row;
-    return NULL;
+
+    if (list->indexed)
+        return list->index[index];
+
+    /* until the next add rebuilds the index, walk from the nearer end */
+    struct drow *row;
+    if (index < list->rowc / 2) {
+        row = list->first;
+        while (index--)
+            row = row->next;
+    } else {
+        row = list->last;
+        for (size_t i = list->rowc - 1; i > index; --i)
+            row = row->prev;
+    }
+    return row;
 }
 
-int cq_field_to_index(const struct dlist *list, const char *field, size_t *out)
+bool cq_dlist_pindex(const struct dlist *list, size_t *out)
 {
-    bool found = false;
+    /* primkey is public and may have been changed since the list was built */
+    if (list->pindex < list->fieldc
+            && !strcmp(list->fieldnames[list->pindex], list->primkey)) {
+        *out = list->pindex;
+        return true;
+    }
 
-    if (list == NULL)
-        return -1;
-    if (field == NULL)
-        return -2;
-    if (out == NULL)
-        return -3;
+    return !cq_field_to_index(list, list->primkey, out);
+}
 
-    for (*out = 0; *out < list->fieldc; ++(*out)) {
-        if (!strcmp(list->fieldnames[*out], field)) {
-            found = true;
+/* finds the fields named by a comma separated list, in its order */
+static size_t names_to_indices(const struct dlist *list, const char *names,
+        size_t *out)
+{
+    size_t n = 0;
+
+    size_t len = strlen(names);
+    char *name = malloc(len + 1);
+    if (name == NULL)
+        return 0;
+
+    for (const char *p = names; *p != '\0'; ) {
+        const char *end = strchr(p, ',');
+        if (end == NULL)
+            end = p + strlen(p);
+
+        memcpy(name, p, end - p);
+        name[end - p] = '\0';
+
+        size_t index;
+        bool ok = n < list->fieldc
+                && !cq_field_to_index(list, name, &index);
+        for (size_t i = 0; ok && i < n; ++i)
+            ok = out[i] != index;
+        if (!ok) {
+            n = 0;
             break;
         }
+
+        out[n++] = index;
+        p = *end ? end + 1 : end;
     }
 
-    return !found;
+    free(name);
+    return n;
 }
 
-int cq_insert(struct dbconn con, const char *table, const struct dlist *list)
+size_t cq_dlist_keyfields(const struct dlist *list, size_t *out)
 {
-    int rc;
-    char *query, *columns, *values;
-    const char *fmt = "INSERT INTO %s(%s) VALUES(%s)";
-
-    if (table == NULL)
+    if (cq_dlist_pindex(list, out))
         return 1;
+
+    return names_to_indices(list, list->primkey, out);
+}
+
+int cq_dlist_index_key(struct dlist *list)
+{
+    size_t pindex;
+
     if (list == NULL)
+        return 1;
+    if (list->keys != NULL)
+        return 0;
+    if (!cq_dlist_pindex(list, &pindex))
         return 2;
 
-    query = calloc(CQ_QLEN, sizeof(char));
-    if (query == NULL)
+    list->keys = cq_new_keyindex(pindex);
+    if (list->keys == NULL)
         return -1;
 
-    columns = calloc(CQ_QLEN/2, sizeof(char));
-    if (columns == NULL) {
-        free(query);
-        return -2;
+    for (struct drow *row = list->first; row != NULL; row = row->next) {
+        if (cq_keyindex_add(list->keys, row)) {
+            cq_free_keyindex(list->keys);
+            list->keys = NULL;
+            return -2;
+        }
     }
 
-    values = calloc(CQ_QLEN/2, sizeof(char));
-    if (values == NULL) {
-        free(query);
-        free(columns);
-        return -3;
-    }
+    return 0;
+}
 
-    rc = cq_dlist_fields_to_utf8(&con, columns, CQ_QLEN/2, *list);
-    if (rc) {
-        free(query);
-        free(columns);
-        free(values);
-        return 100;
-    }
+struct drow *cq_dlist_find(const struct dlist *list, const char *key)
+{
+    size_t pindex;
 
-    rc = cq_connect(&con);
-    if (rc) {
-        free(query);
-        free(columns);
-        free(values);
-        return 200;
-    }
+    if (list == NULL || key == NULL)
+        return NULL;
 
-    for (struct drow *r = list->first; r != NULL; r = r->next) {
-        rc = cq_drow_to_utf8(&con, values, CQ_QLEN/2, *r);
-        if (rc)
-            break;
+    size_t len = strlen(key);
+    if (list->keys != NULL)
+        return cq_keyindex_find(list->keys, key, len);
 
-        rc = snprintf(query, CQ_QLEN, fmt, table, columns, values);
-        if (CQ_QLEN <= (size_t) rc) {
-            rc = -4;
-            break;
-        }
+    if (!cq_dlist_pindex(list, &pindex))
+        return NULL;
 
-        rc = cq_query(&con, query);
-        if (rc) {
-            rc = 201;
-            break;
-        }
-    }
+    for (struct drow *row = list->first; row != NULL; row = row->next)
+        if (row->lengths[pindex] == len
+                && !memcmp(row->values[pindex], key, len))
+            return row;
 
-    cq_close_connection(&con);
-    free(query);
-    free(columns);
-    free(values);
-    return rc;
+    return NULL;
 }
 
-int cq_update(struct dbconn con, const char *table, const struct dlist *list)
+int cq_dlist_upsert_row(struct dlist *list, struct drow *row)
 {
-    int rc;
-    char *query, *columns;
-    const char *fmt = "UPDATE %s SET %s WHERE %s=%s";
+    size_t pindex;
+    struct drow *old = NULL;
 
-    if (table == NULL)
-        return 1;
     if (list == NULL)
+        return 1;
+    if (row == NULL)
         return 2;
+    if (row->fieldc != list->fieldc)
+        return 3;
+    if (!cq_dlist_pindex(list, &pindex))
+        return 4;
 
-    query = calloc(CQ_QLEN, sizeof(char));
-    if (query == NULL)
-        return -1;
+    if (list->keys != NULL) {
+        old = cq_keyindex_find(list->keys, row->values[pindex],
+                row->lengths[pindex]);
+    } else {
+        for (old = list->first; old != NULL; old = old->next)
+            if (old->lengths[pindex] == row->lengths[pindex]
+                    && !memcmp(old->values[pindex], row->values[pindex],
+                            row->lengths[pindex]))
+                break;
+    }
 
-    columns = calloc(CQ_QLEN/2, sizeof(char));
-    if (columns == NULL) {
-        free(query);
-        return -2;
+    if (old == NULL) {
+        cq_dlist_add(list, row);
+        return 0;
     }
 
-    size_t pindex;
+    for (size_t i = 0; i < row->fieldc; ++i)
+        if (i != pindex && drow_copy_value(old, row, i))
+            return -1;
+
+    cq_free_drow(row);
+    return 0;
+}
+
+int cq_field_to_index(const struct dlist *list, const char *field, size_t *out)
+{
     bool found = false;
-    for (pindex = 0; pindex < list->fieldc; ++pindex) {
-        if (!strcmp(list->fieldnames[pindex], list->primkey)) {
+
+    if (list == NULL)
+        return -1;
+    if (field == NULL)
+        return -2;
+    if (out == NULL)
+        return -3;
+
+    if (list->fieldmap != NULL)
+        return !cq_fieldmap_find(list, field, out);
+
+    for (*out = 0; *out < list->fieldc; ++(*out)) {
+        if (!strcmp(list->fieldnames[*out], field)) {
             found = true;
             break;
         }
     }
 
-    if (!found) {
-        free(query);
-        free(columns);
-        return 3;
-    }
+    return !found;
+}
 
-    rc = cq_connect(&con);
+/* sends one batched statement and reports it to the connection's callback */
+static int batch_query(struct dbconn *con, const struct cq_buf *query,
+        size_t first, size_t rows, unsigned long long *affected)
+{
+    if (cq_query_buf(con, query))
+        return 201;
+
+    unsigned long long n = mysql_affected_rows(con->con);
+    if (affected != NULL)
+        *affected += n;
+    if (con->on_batch != NULL)
+        con->on_batch(first, rows, n, con->batch_data);
+
+    return cq_txn_sent(con, rows, query->len);
+}
+
+int cq_insert_rows(struct dbconn *con, const char *table,
+        const struct dlist *list, const struct drow *start, size_t count,
+        size_t base, unsigned long long *affected)
+{
+    int rc = 0;
+    struct cq_buf query, values;
+    size_t prefix, rows = 0, first = base;
+
+    if (cq_can_prepare_rows(con, start, count))
+        return cq_prep_insert(con, table, list, start, count, base, affected);
+
+    size_t qlen = cq_qlen(con);
+
+    cq_buf_init(&query);
+    cq_buf_init(&values);
+
+    if (!cq_buf_printf(&query, "INSERT INTO %s(", table)
+            || cq_dlist_fields_to_utf8(con, &query, *list)
+            || !cq_buf_puts(&query, ") VALUES"))
+        rc = 100;
+    prefix = query.len;
+
+    /* pack rows into each statement until the batch is full or the next row
+       would take it past the query length; a longer row is sent alone */
+    const struct drow *r = start;
+    for (size_t n = 0; n < count && !rc; ++n, r = r->next) {
+        cq_buf_reset(&values);
+        if (cq_drow_to_utf8(con, &values, list, r)) {
+            rc = -1;
+            break;
+        }
+
+        if (rows && query.len + values.len + 3 > qlen) {
+            rc = batch_query(con, &query, first, rows, affected);
+            if (rc)
+                break;
+
+            first += rows;
+            rows = 0;
+            cq_buf_truncate(&query, prefix);
+        }
+
+        if ((rows && !cq_buf_append(&query, ",", 1))
+                || !cq_buf_append(&query, "(", 1)
+                || !cq_buf_append(&query, values.data, values.len)
+                || !cq_buf_append(&query, ")", 1)) {
+            rc = -2;
+            break;
+        }
+        ++rows;
+
+        if (rows == con->batch || n + 1 == count) {
+            rc = batch_query(con, &query, first, rows, affected);
+            if (rc)
+                break;
+
+            first += rows;
+            rows = 0;
+            cq_buf_truncate(&query, prefix);
+        }
+    }
+
+    cq_buf_free(&query);
+    cq_buf_free(&values);
+    return rc;
+}
+
+int cq_insert(struct dbconn con, const char *table, const struct dlist *list)
+{
+    int rc;
+    bool owned;
+    struct cq_txn txn;
+
+    if (table == NULL)
+        return 1;
+    if (list == NULL)
+        return 2;
+
+    rc = cq_acquire(&con, &owned);
+    if (rc)
+        return 200;
+
+    rc = cq_txn_begin(&con, &txn);
+    if (!rc)
+        rc = cq_insert_rows(&con, table, list, list->first, list->rowc, 0,
+                NULL);
+    rc = cq_txn_end(&con, rc);
+
+    cq_release(&con, owned);
+    return rc;
+}
+
+int cq_update(struct dbconn con, const char *table, const struct dlist *list)
+{
+    int rc;
+    bool owned;
+    struct cq_buf query;
+    struct cq_txn txn;
+    size_t first = 0, fixed;
+
+    if (table == NULL)
+        return 1;
+    if (list == NULL)
+        return 2;
+
+    size_t *keys = calloc(list->fieldc ? list->fieldc : 1, sizeof(size_t));
+    if (keys == NULL)
+        return -1;
+
+    size_t keyc = cq_dlist_keyfields(list, keys);
+    if (keyc == 0) {
+        free(keys);
+        return 3;
+    }
+    size_t pindex = keys[0];
+
+    rc = cq_acquire(&con, &owned);
     if (rc) {
-        free(query);
-        free(columns);
+        free(keys);
         return 200;
     }
 
-    for (struct drow *r = list->first; r != NULL; r = r->next) {
-        rc = cq_dlist_to_update_utf8(&con, columns, CQ_QLEN/2, *list, *r);
-        if (rc) {
-            rc = 101;
-            break;
+    rc = cq_txn_begin(&con, &txn);
+    if (rc) {
+        cq_release(&con, owned);
+        free(keys);
+        return rc;
+    }
+
+    if (cq_can_prepare_rows(&con, list->first, list->rowc)) {
+        rc = cq_prep_update(&con, table, list, keys, keyc);
+        rc = cq_txn_end(&con, rc);
+        cq_release(&con, owned);
+        free(keys);
+        return rc;
+    }
+
+    size_t qlen = cq_qlen(&con);
+
+    /* length of a CASE statement before any rows are added */
+    fixed = strlen("UPDATE  SET  WHERE  IN ()") + strlen(table)
+            + strlen(list->primkey) + 1;
+    for (size_t i = 0; i < list->fieldc; ++i)
+        if (i != pindex)
+            fixed += strlen(list->fieldnames[i]) + strlen(list->primkey)
+                    + strlen(",=CASE  END");
+
+    cq_buf_init(&query);
+
+    struct drow *r = list->first;
+    rc = 0;
+    while (r != NULL) {
+        /* take as many rows as the batch and query length allow; rows with
+           a composite key are updated one at a time */
+        size_t rows = 0, cost = fixed;
+        struct drow *end = r;
+        while (end != NULL && (con.batch == 0 || rows < con.batch)
+                && (keyc == 1 || rows == 0)) {
+            size_t c = cq_case_row_cost(list, pindex, end);
+            if (rows && cost + c >= qlen)
+                break;
+
+            cost += c;
+            ++rows;
+            end = end->next;
         }
 
-        rc = snprintf(query, CQ_QLEN, fmt, table, columns, list->primkey,
-                r->values[pindex]);
-        if ((size_t) rc >= CQ_QLEN) {
-            rc = 102;
+        cq_buf_reset(&query);
+        if (!cq_buf_printf(&query, "UPDATE %s SET ", table)) {
+            rc = -2;
             break;
         }
 
-        rc = cq_query(&con, query);
+        if (rows == 1) {
+            rc = cq_dlist_to_update_utf8(&con, &query, *list, *r, keys,
+                    keyc);
+            for (size_t k = 0; k < keyc && !rc; ++k) {
+                if (!cq_buf_printf(&query, " %s %s=", k ? "AND" : "WHERE",
+                            list->fieldnames[keys[k]])
+                        || !cq_buf_cell(&query, &con, list, r, keys[k]))
+                    rc = -3;
+            }
+        } else {
+            rc = cq_dlist_to_case_utf8(&con, &query, list, pindex, r, rows);
+        }
         if (rc) {
-            rc = 201;
+            rc = 101;
             break;
         }
+
+        rc = batch_query(&con, &query, first, rows, NULL);
+        if (rc)
+            break;
+
+        first += rows;
+        r = end;
     }
 
-    cq_close_connection(&con);
-    free(query);
-    free(columns);
+    rc = cq_txn_end(&con, rc);
+    cq_release(&con, owned);
+    cq_buf_free(&query);
+    free(keys);
     return rc;
 }
 
 int cq_select_query(struct dbconn con, struct dlist **out, const char *q)
 {
     int rc;
-    char *query;
+    bool owned;
+    struct cq_buf query;
 
     if (q == NULL)
         return 1;
-    if (strlen(q) >= CQ_QLEN)
-        return 2;
 
-    query = calloc(CQ_QLEN, sizeof(char));
-    if (query == NULL)
+    cq_buf_init(&query);
+    if (!cq_buf_printf(&query, "SELECT %s", q)) {
+        cq_buf_free(&query);
         return -1;
-
-    rc = snprintf(query, CQ_QLEN, "SELECT %s", q);
-    if (CQ_QLEN <= (size_t) rc) {
-        free(query);
-        return 100;
     }
 
-    rc = cq_connect(&con);
+    rc = cq_acquire(&con, &owned);
     if (rc) {
-        free(query);
+        cq_buf_free(&query);
         return 200;
     }
 
-    rc = cq_query(&con, query);
+    rc = cq_query_buf(&con, &query);
+    cq_buf_free(&query);
     if (rc) {
-        free(query);
-        cq_close_connection(&con);
+        cq_release(&con, owned);
         return 201;
     }
 
     MYSQL_RES *result = mysql_store_result(con.con);
-    cq_close_connection(&con);
     if (result == NULL) {
-        free(query);
+        cq_release(&con, owned);
         return 202;
     }
 
-    char *from = strcasestr(query, u8"FROM") + strlen(u8"FROM");
-    do {
-        ++from;
-    } while (isblank(*from) || *from == '\n');
-    size_t len = 0;
-    while (*(from + len) && !isblank(*(from + len)) && *(from + len) != '\n')
-        ++len;
+    rc = cq_result_to_dlist(&con, result, true, out);
+    cq_release(&con, owned);
+    return rc;
+}
 
-    char *table = calloc(len+1, sizeof(char));
-    strncpy(table, from, len);
-    table[len] = '\0';
-    free(query);
+/* builds a list from a stored result set, which the list takes over; unless
+   lookup is set, the primary key is only taken from the metadata cache */
+int cq_result_to_dlist(struct dbconn *con, void *res, bool lookup,
+        struct dlist **out)
+{
+    int rc = 0;
+    MYSQL_RES *result = res;
 
     size_t num_fields = mysql_num_fields(result);
     if (!num_fields) {
-        free(table);
         mysql_free_result(result);
         *out = NULL;
         return 0;
@@ -604,7 +1163,6 @@ int cq_select_query(struct dbconn con, struct dlist **out, const char *q)
 
     char **fieldnames = calloc(num_fields, sizeof(char *));
     if (fieldnames == NULL) {
-        free(table);
         mysql_free_result(result);
         return -3;
     }
@@ -616,7 +1174,7 @@ int cq_select_query(struct dbconn con, struct dlist **out, const char *q)
             break;
 
         size_t flen = strlen(field->name);
-        fieldnames[i] = calloc(flen, sizeof(char));
+        fieldnames[i] = calloc(flen+1, sizeof(char));
         if (fieldnames[i] == NULL) {
             rc = -4;
             break;
@@ -629,35 +1187,25 @@ int cq_select_query(struct dbconn con, struct dlist **out, const char *q)
             free(fieldnames[j]);
         }
         free(fieldnames);
-        free(table);
         mysql_free_result(result);
         return rc;
     }
 
-    char *primkey = calloc(CQ_QLEN, sizeof(char));
+    /* the flags name the selected key columns; the table's key says whether
+       they are all of it */
+    char *primkey = cq_fields_primkey(con, mysql_fetch_fields(result),
+            num_fields, lookup);
     if (primkey == NULL) {
         for (size_t j = 0; j < i; ++j) {
             free(fieldnames[j]);
         }
         free(fieldnames);
-        free(table);
         mysql_free_result(result);
         return -5;
     }
 
-    rc = cq_get_primkey(con, table, primkey, CQ_QLEN);
-    free(table);
-    if (rc) {
-        for (size_t j = 0; j < i; ++j) {
-            free(fieldnames[j]);
-        }
-        free(fieldnames);
-        mysql_free_result(result);
-        return 205;
-    }
-
-    *out = cq_new_dlist(num_fields, fieldnames, primkey);
-    for (size_t j = 0; j <= i; ++j) {
+    *out = cq_new_dlist_ctx(con->ctx, num_fields, fieldnames, primkey);
+    for (size_t j = 0; j < i; ++j) {
         free(fieldnames[j]);
     }
     free(fieldnames);
@@ -668,74 +1216,277 @@ int cq_select_query(struct dbconn con, struct dlist **out, const char *q)
         return -6;
     }
 
-    MYSQL_ROW row;
-    char **rvals = calloc(num_fields, sizeof(char *));
-    if (rvals == NULL) {
+    /* the list keeps the result set, whose buffers become its values */
+    (*out)->result = result;
+
+    if (cq_dlist_set_types(*out, mysql_fetch_fields(result))
+            || cq_dlist_use_arena(*out)) {
         cq_free_dlist(*out);
-        mysql_free_result(result);
+        *out = NULL;
+        return -7;
     }
-    size_t in = 0;
+
+    MYSQL_ROW row;
     while ((row = mysql_fetch_row(result))) {
-        struct drow *data = cq_new_drow(num_fields);
+        struct drow *data = cq_dlist_new_drow(*out);
         if (data == NULL) {
-            rc = -7;
+            rc = -8;
             break;
         }
 
-        for (in = 0; in < num_fields; ++in) {
-            size_t len = strlen(row[in]);
-            rvals[in] = calloc(len+1, sizeof(char));
-            if (rvals[in] == NULL) {
-                rc = -8;
-                break;
-            }
-            strcpy(rvals[in], row[in]);
-        }
-        if (rc) {
-            break;
-        }
+        drow_adopt(data, row, mysql_fetch_lengths(result));
+        cq_dlist_add(*out, data);
+    }
 
-        rc = cq_drow_set(data, rvals);
-        if (rc) {
-            break;
-        }
+    if (rc) {
+        cq_free_dlist(*out);
+        *out = NULL;
+    }
 
-        cq_dlist_add(*out, data);
+    return rc;
+}
+
+int cq_select_each(struct dbconn con, const char *q, cq_row_fn fn,
+        void *data)
+{
+    int rc;
+    bool owned;
+    char *primkey;
+    struct cq_buf query;
+
+    if (q == NULL)
+        return 1;
+    if (fn == NULL)
+        return 2;
+
+    cq_buf_init(&query);
+    if (!cq_buf_printf(&query, "SELECT %s", q)) {
+        cq_buf_free(&query);
+        return -1;
     }
 
-    for (size_t j = 0; j < in; ++j) {
-        free(rvals[j]);
+    rc = cq_acquire(&con, &owned);
+    if (rc) {
+        cq_buf_free(&query);
+        return 200;
     }
-    free(rvals);
-    mysql_free_result(result);
 
+    rc = cq_query_buf(&con, &query);
+    cq_buf_free(&query);
     if (rc) {
-        cq_free_dlist(*out);
+        cq_release(&con, owned);
+        return 201;
     }
 
-    return 0;
+    MYSQL_RES *result = mysql_use_result(con.con);
+    if (result == NULL) {
+        cq_release(&con, owned);
+        return 202;
+    }
+
+    size_t num_fields = mysql_num_fields(result);
+    MYSQL_FIELD *fields = mysql_fetch_fields(result);
+    /* the connection is busy with the rows, so the key must be cached */
+    primkey = cq_fields_primkey(&con, fields, num_fields, false);
+    if (primkey == NULL) {
+        mysql_free_result(result);
+        cq_release(&con, owned);
+        return -2;
+    }
+
+    char **fieldnames = calloc(num_fields, sizeof(char *));
+    if (fieldnames == NULL) {
+        mysql_free_result(result);
+        cq_release(&con, owned);
+        free(primkey);
+        return -3;
+    }
+
+    for (size_t i = 0; i < num_fields; ++i)
+        fieldnames[i] = fields[i].name;
+
+    struct dlist *list = cq_new_dlist_ctx(con.ctx, num_fields, fieldnames,
+            primkey);
+    free(fieldnames);
+    free(primkey);
+    if (list == NULL || cq_dlist_set_types(list, fields)) {
+        cq_free_dlist(list);
+        mysql_free_result(result);
+        cq_release(&con, owned);
+        return -4;
+    }
+
+    /* every row is delivered through the same buffer */
+    struct drow *buf = cq_dlist_new_drow(list);
+    if (buf == NULL) {
+        cq_free_dlist(list);
+        mysql_free_result(result);
+        cq_release(&con, owned);
+        return -5;
+    }
+
+    MYSQL_ROW row;
+    rc = 0;
+    while ((row = mysql_fetch_row(result))) {
+        if (cq_drow_set_lens(buf, row, mysql_fetch_lengths(result))) {
+            rc = 204;
+            break;
+        }
+
+        if (fn(list, buf, data))
+            break;
+    }
+
+    if (!rc && row == NULL && mysql_errno(con.con))
+        rc = 203;
+
+    /* discards any rows the callback did not consume */
+    mysql_free_result(result);
+    cq_release(&con, owned);
+    cq_free_drow(buf);
+    cq_free_dlist(list);
+    return rc;
 }
 
 int cq_select_all(struct dbconn con, const char *table, struct dlist **out,
         const char *conditions)
 {
     int rc;
-    char *query;
+    struct cq_buf query;
     const char *fmt = strcmp(conditions, u8"") ?
             "* FROM %s WHERE %s" : u8"* FROM %s%s";
 
-    query = calloc(CQ_QLEN, sizeof(char));
-    if (query == NULL)
+    cq_buf_init(&query);
+    if (!cq_buf_printf(&query, fmt, table, conditions)) {
+        cq_buf_free(&query);
         return -10;
+    }
+
+    rc = cq_select_query(con, out, query.data);
+    cq_buf_free(&query);
+    return rc;
+}
+
+/* the condition matching the rows whose keys follow that of a page's last
+   row; a composite key is compared as a row */
+static bool after_last(struct cq_buf *buf, struct dbconn *con,
+        const struct dlist *page, const char *key, const size_t *keys,
+        size_t keyc)
+{
+    if (!cq_buf_puts(buf, keyc > 1 ? "(" : "")
+            || !cq_buf_puts(buf, key)
+            || !cq_buf_puts(buf, keyc > 1 ? ")>(" : ">"))
+        return false;
+
+    for (size_t k = 0; k < keyc; ++k)
+        if ((k && !cq_buf_puts(buf, ","))
+                || !cq_buf_cell(buf, con, page, page->last, keys[k]))
+            return false;
+
+    return cq_buf_puts(buf, keyc > 1 ? ")" : "");
+}
+
+/* the key's columns are taken in index order, so that the pages are sorted
+   and bounded along the index itself */
+static int page_key(struct dbconn *con, const char *table, struct cq_buf *order)
+{
+    char *key;
+
+    int rc = cq_table_primkey(con, NULL, table, true, &key);
+    if (rc == 203)
+        return 4;
+    if (rc)
+        return rc;
+
+    rc = cq_buf_puts(order, key) ? 0 : -3;
+    free(key);
+    return rc;
+}
+
+int cq_select_pages(struct dbconn con, const char *table,
+        const char *conditions, size_t pagelen, cq_page_fn fn, void *data)
+{
+    int rc;
+    bool owned;
+    size_t *keys = NULL, keyc = 0;
+    struct cq_buf filter, order, after, query;
+
+    if (table == NULL)
+        return 1;
+    if (pagelen == 0)
+        return 2;
+    if (fn == NULL)
+        return 3;
+
+    cq_buf_init(&filter);
+    if (!cq_buf_puts(&filter, "")
+            || (conditions != NULL && strcmp(conditions, u8"")
+                && !cq_buf_printf(&filter, " WHERE (%s)", conditions))) {
+        cq_buf_free(&filter);
+        return -1;
+    }
 
-    rc = snprintf(query, CQ_QLEN, fmt, table, conditions);
-    if (CQ_QLEN <= (size_t)rc) {
-        free(query);
-        return 100;
+    rc = cq_acquire(&con, &owned);
+    if (rc) {
+        cq_buf_free(&filter);
+        return 200;
     }
 
-    rc = cq_select_query(con, out, query);
-    free(query);
+    cq_buf_init(&order);
+    cq_buf_init(&after);
+    cq_buf_init(&query);
+
+    rc = page_key(&con, table, &order);
+
+    /* each page starts after the last key of the one before, so the server
+       seeks along the key rather than skipping rows as OFFSET would */
+    while (!rc) {
+        struct dlist *page = NULL;
+
+        cq_buf_reset(&query);
+        if (!cq_buf_printf(&query, "* FROM %s%s", table, filter.data)
+                || (after.len && !cq_buf_printf(&query, " %s %s",
+                        filter.len ? "AND" : "WHERE", after.data))
+                || !cq_buf_printf(&query, " ORDER BY %s LIMIT %zu",
+                        order.data, pagelen)) {
+            rc = -4;
+            break;
+        }
+
+        rc = cq_select_query(con, &page, query.data);
+        if (rc)
+            break;
+
+        /* every page has the same columns, so the first places the key */
+        bool more = page->rowc == pagelen;
+        if (more && keys == NULL) {
+            keys = calloc(page->fieldc ? page->fieldc : 1, sizeof(size_t));
+            keyc = keys != NULL ? names_to_indices(page, order.data, keys) : 0;
+            if (keyc == 0)
+                rc = keys == NULL ? -5 : 4;
+        }
+
+        /* the next page's bound is taken before the caller sees this one */
+        cq_buf_reset(&after);
+        if (rc)
+            more = false;
+        else if (more && !after_last(&after, &con, page, order.data, keys,
+                    keyc))
+            rc = -6;
+        else if (page->rowc && fn(page, data))
+            more = false;
+
+        cq_free_dlist(page);
+        if (!more)
+            break;
+    }
+
+    free(keys);
+    cq_buf_free(&query);
+    cq_buf_free(&after);
+    cq_buf_free(&order);
+    cq_buf_free(&filter);
+    cq_release(&con, owned);
     return rc;
 }
 
@@ -743,40 +1494,43 @@ int cq_select_func_arr(struct dbconn con, const char *func, char * const *args,
         size_t num_args, struct dlist **out)
 {
     int rc;
-    char *query, *fargs;
-    const char *fmt = "%s(%s)";
+    bool owned;
+    struct cq_buf query;
 
     if (NULL == func || NULL == args)
         return 1;
 
-    query = calloc(CQ_QLEN, sizeof(char));
-    if (NULL == query)
+    cq_buf_init(&query);
+    if (!cq_buf_printf(&query, "%s(", func)) {
+        cq_buf_free(&query);
         return -1;
+    }
 
-    fargs = calloc(CQ_QLEN, sizeof(char));
-    if (NULL == fargs) {
-        free(query);
-        return -2;
+    /* the arguments are escaped on the connection that runs the query */
+    rc = cq_acquire(&con, &owned);
+    if (rc) {
+        cq_buf_free(&query);
+        return 200;
     }
 
     if (0 != num_args) {
-        rc = cq_fields_to_utf8(&con, fargs, CQ_QLEN, num_args, args, true);
+        rc = cq_fields_to_utf8(&con, &query, num_args, args, NULL, true);
         if (rc) {
-            free(query);
-            free(fargs);
+            cq_release(&con, owned);
+            cq_buf_free(&query);
             return 110;
         }
     }
 
-    rc = snprintf(query, CQ_QLEN, fmt, func, fargs);
-    free(fargs);
-    if (CQ_QLEN <= (size_t) rc) {
-        free(query);
-        return 111;
+    if (!cq_buf_puts(&query, ")")) {
+        cq_release(&con, owned);
+        cq_buf_free(&query);
+        return -2;
     }
 
-    rc = cq_select_query(con, out, query);
-    free(query);
+    rc = cq_select_query(con, out, query.data);
+    cq_release(&con, owned);
+    cq_buf_free(&query);
     return rc;
 }
 
@@ -786,55 +1540,112 @@ int cq_select_func_drow(struct dbconn con, const char *func, struct drow row,
     return cq_select_func_arr(con, func, row.values, row.fieldc, out);
 }
 
-int cq_get_primkey(struct dbconn con, const char *table, char *out,
-        size_t len)
+/* joins the rows of SHOW KEYS for a primary key in the order of the index */
+static int key_columns(MYSQL_RES *result, struct cq_buf *out)
 {
-    int rc;
-    char *query;
-    const char *fmt = "SHOW KEYS FROM %s WHERE Key_name = 'PRIMARY'";
+    size_t n = mysql_num_rows(result);
+    if (n == 0)
+        return 203;
 
-    query = calloc(CQ_QLEN, sizeof(char));
-    if (query == NULL)
-        return -20;
+    const char **cols = calloc(n, sizeof(char *));
+    if (cols == NULL)
+        return -2;
 
-    rc = snprintf(query, CQ_QLEN, fmt, table);
-    if (CQ_QLEN <= (size_t) rc) {
-        free(query);
-        return 100;
+    /* 4th column is Seq_in_index, counted from 1; 5th is the column name */
+    int rc = 0;
+    MYSQL_ROW row;
+    while (!rc && (row = mysql_fetch_row(result))) {
+        unsigned long seq = strtoul(row[3], NULL, 10);
+        if (seq < 1 || seq > n || cols[seq - 1] != NULL)
+            rc = 205;
+        else
+            cols[seq - 1] = row[4];
     }
 
-    rc = cq_connect(&con);
-    if (rc) {
-        free(query);
-        return 200;
+    for (size_t i = 0; i < n && !rc; ++i)
+        if (cols[i] == NULL || (i && !cq_buf_puts(out, ","))
+                || !cq_buf_puts(out, cols[i]))
+            rc = cols[i] == NULL ? 205 : -3;
+
+    free(cols);
+    return rc;
+}
+
+int cq_table_primkey(struct dbconn *con, const char *db, const char *table,
+        bool lookup, char **out)
+{
+    int rc;
+    struct cq_buf query, key;
+
+    /* cached under the database that holds the table */
+    struct dbconn meta = *con;
+    if (db != NULL && db[0] != '\0')
+        meta.database = db;
+    else
+        db = NULL;
+
+    *out = cq_meta_get_primkey(&meta, table);
+    if (*out != NULL)
+        return 0;
+    if (!lookup)
+        return 1;
+
+    cq_buf_init(&query);
+    if (!cq_buf_printf(&query, "SHOW KEYS FROM %s%s%s WHERE Key_name = "
+                "'PRIMARY'", table, db ? " FROM " : "", db ? db : "")) {
+        cq_buf_free(&query);
+        return -1;
     }
 
-    rc = cq_query(&con, query);
-    free(query);
-    if (rc) {
-        cq_close_connection(&con);
+    rc = cq_query_buf(con, &query);
+    cq_buf_free(&query);
+    if (rc)
         return 201;
-    }
 
-    MYSQL_RES *result = mysql_store_result(con.con);
-    cq_close_connection(&con);
+    MYSQL_RES *result = mysql_store_result(con->con);
     if (result == NULL)
         return 202;
 
-    MYSQL_ROW row = mysql_fetch_row(result);
-    if (!row) {
-        mysql_free_result(result);
-        return 203;
+    cq_buf_init(&key);
+    rc = key_columns(result, &key);
+    mysql_free_result(result);
+
+    if (!rc) {
+        cq_meta_put_primkey(&meta, table, key.data);
+        *out = key.data;
+    } else {
+        cq_buf_free(&key);
     }
 
-    /* 5th column is documented to be the column name */
-    rc = 0;
-    if (strlen(row[4]) >= len)
+    return rc;
+}
+
+int cq_get_primkey(struct dbconn con, const char *table, char *out,
+        size_t len)
+{
+    int rc;
+    bool owned;
+    char *key;
+
+    if (table == NULL || out == NULL)
+        return 1;
+
+    rc = cq_acquire(&con, &owned);
+    if (rc)
+        return 200;
+
+    rc = cq_table_primkey(&con, NULL, table, true, &key);
+    cq_release(&con, owned);
+    if (rc)
+        return rc;
+
+    if (strlen(key) >= len) {
         rc = 204;
-    else
-        strcpy(out, row[4]);
-    mysql_free_result(result);
+    } else {
+        strcpy(out, key);
+    }
 
+    free(key);
     return rc;
 }
 
@@ -842,8 +1653,8 @@ int cq_get_fields(struct dbconn con, const char *table, size_t *out_fieldc,
         char **out_names, size_t nblen)
 {
     int rc;
-    char *query;
-    const char *fmt = "SHOW COLUMNS IN %s";
+    bool owned;
+    struct cq_buf query;
 
     if (table == NULL)
         return 1;
@@ -851,100 +1662,112 @@ int cq_get_fields(struct dbconn con, const char *table, size_t *out_fieldc,
     bool getting_names = !(out_names == NULL);
     bool getting_count = !(out_fieldc == NULL);
 
-    query = calloc(CQ_QLEN, sizeof(char));
-    if (query == NULL) {
-        return -1;
-    }
+    rc = cq_meta_get_fields(&con, table, out_fieldc, out_names, nblen);
+    if (rc != 1)
+        return rc ? 203 : 0;
 
-    rc = snprintf(query, CQ_QLEN, fmt, table);
-    if (CQ_QLEN <= (size_t) rc) {
-        free(query);
-        return 100;
+    cq_buf_init(&query);
+    if (!cq_buf_printf(&query, "SHOW COLUMNS IN %s", table)) {
+        cq_buf_free(&query);
+        return -1;
     }
 
-    rc = cq_connect(&con);
+    rc = cq_acquire(&con, &owned);
     if (rc) {
-        free(query);
+        cq_buf_free(&query);
         return 200;
     }
 
-    rc = cq_query(&con, query);
-    free(query);
-    if (rc)
+    rc = cq_query_buf(&con, &query);
+    cq_buf_free(&query);
+    if (rc) {
+        cq_release(&con, owned);
         return 201;
+    }
 
     MYSQL_RES *result = mysql_store_result(con.con);
-    cq_close_connection(&con);
+    cq_release(&con, owned);
     if (result == NULL)
         return 202;
 
+    /* the cache keeps every name, even when only the count is wanted */
+    size_t num_rows = mysql_num_rows(result);
+    char **names = calloc(num_rows ? num_rows : 1, sizeof(char *));
+    if (names == NULL) {
+        mysql_free_result(result);
+        return -2;
+    }
+
     MYSQL_ROW row;
-    size_t num_rows = 0;
+    size_t i = 0;
     rc = 0;
-    while ((row = mysql_fetch_row(result))) {
-        if (getting_names) {
-            if (strlen(row[0]) >= nblen) {
+    while (i < num_rows && (row = mysql_fetch_row(result))) {
+        names[i] = row[0];
+        if (getting_names && !rc) {
+            if (strlen(row[0]) >= nblen)
                 rc = 203;
-                break;
-            }
-            strcpy(out_names[num_rows], row[0]);
+            else
+                strcpy(out_names[i], row[0]);
         }
-        ++num_rows;
+        ++i;
     }
+
+    cq_meta_put_fields(&con, table, i, names);
+    free(names);
     mysql_free_result(result);
 
     if (getting_count)
-        *out_fieldc = num_rows;
+        *out_fieldc = i;
 
-    return 0;
+    return rc;
 }
 
 int cq_proc_arr(struct dbconn con, const char *proc, char * const *args,
         size_t num_args)
 {
     int rc = 0;
-    char *query, *fargs;
-    const char *fmt = "CALL %s(%s)";
+    bool owned;
+    struct cq_buf query;
 
     if (NULL == proc || NULL == args)
         return 1;
 
-    query = calloc(CQ_QLEN, sizeof(char));
-    if (NULL == query)
-        return -1;
+    rc = cq_acquire(&con, &owned);
+    if (rc)
+        return 200;
 
-    fargs = calloc(CQ_QLEN, sizeof(char));
-    if (NULL == fargs) {
-        free(query);
-        return -2;
+    if (cq_can_prepare(&con, num_args, args)) {
+        rc = cq_prep_proc(&con, proc, args, num_args);
+        cq_release(&con, owned);
+        return rc;
+    }
+
+    cq_buf_init(&query);
+    if (!cq_buf_printf(&query, "CALL %s(", proc)) {
+        cq_release(&con, owned);
+        cq_buf_free(&query);
+        return -1;
     }
 
     if (0 != num_args) {
-        rc = cq_fields_to_utf8(&con, fargs, CQ_QLEN, num_args, args, true);
+        rc = cq_fields_to_utf8(&con, &query, num_args, args, NULL, true);
         if (rc) {
-            free(query);
-            free(fargs);
+            cq_release(&con, owned);
+            cq_buf_free(&query);
             return 100;
         }
     }
 
-    rc = snprintf(query, CQ_QLEN, fmt, proc, fargs);
-    free(fargs);
-    if (CQ_QLEN <= (size_t)rc) {
-        free(query);
-        return 101;
-    }
-
-    rc = cq_connect(&con);
-    if (rc) {
-        free(query);
-        return 200;
+    if (!cq_buf_puts(&query, ")")) {
+        cq_release(&con, owned);
+        cq_buf_free(&query);
+        return -2;
     }
 
-    rc = cq_query(&con, query);
-    free(query);
+    rc = cq_query_buf(&con, &query);
+    cq_buf_free(&query);
 
-    cq_close_connection(&con);
+    cq_release(&con, owned);
     return rc ? 201 : 0;
 }
 
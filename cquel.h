@@ -60,13 +60,81 @@ extern "C"
 #endif
 
 /**
- * @brief Initializes the cquel library.
- * @param qlen Maximum length of the query strings used by cquel.
- * @param fmaxlen Length of the buffer for each field and value.
+ * @brief Initializes the cquel library and sets the limits used by connections
+ * without a context of their own; call it before starting other threads.
+ * @param qlen Length at which batched INSERT and UPDATE statements, and the
+ * packets of a pipeline, are split; other statements grow as needed. If 0, as
+ * without a call to cq_init(), each is filled up to the server's
+ * max_allowed_packet, which is looked up once.
+ * @param fmaxlen Maximum length of each field name; without a call to
+ * cq_init(), or if 0, field names are not limited.
  */
 void cq_init(size_t qlen, size_t fmaxlen);
 
+/**
+ * @brief Counts of the work done through a context.
+ */
+struct cq_stats {
+    unsigned long long queries;
+    unsigned long long errors;
+    unsigned long long connects;
+    unsigned long long meta_hits;
+    unsigned long long meta_misses;
+};
+
+/**
+ * @brief Instantiates a context holding the limits, table metadata cache and
+ * statistics of the connections which name it. Connections without one share
+ * a default context set up by cq_init().
+ * @param qlen Length at which batched INSERT and UPDATE statements are split,
+ * or 0 for the server's packet limit, as for cq_init().
+ * @param fmaxlen Maximum length of each field name, as for cq_init().
+ * @return A pointer to the new context or NULL on failure.
+ */
+struct cq_ctx *cq_new_ctx(size_t qlen, size_t fmaxlen);
+
+/**
+ * @brief Frees a context and its metadata cache.
+ * @param ctx The context to be freed; no connection may still be using it.
+ */
+void cq_free_ctx(struct cq_ctx *ctx);
+
+/**
+ * @brief Sets how long a context's cached table metadata is used before it is
+ * looked up again; the default is 60 seconds.
+ * @param ctx The context to be changed, or NULL for the default context.
+ * @param seconds The lifetime of cached metadata; 0 disables the cache.
+ */
+void cq_ctx_set_meta_ttl(struct cq_ctx *ctx, unsigned int seconds);
+
+/**
+ * @brief Gets the counts of queries, failed queries, connections opened and
+ * metadata cache lookups of a context since it was made. Safe to call while
+ * other threads use the context.
+ * @param ctx The context to be examined, or NULL for the default context.
+ * @param out Destination for the counts.
+ */
+void cq_ctx_stats(struct cq_ctx *ctx, struct cq_stats *out);
+
 struct drow;
+struct cq_pool;
+struct cq_stmt_cache;
+struct cq_arena;
+struct cq_keyindex;
+struct cq_async;
+struct cq_ctx;
+struct cq_txn;
+struct cq_pipeline;
+
+/**
+ * @brief Receives the outcome of each statement sent by a batched write.
+ * @param first Index in the data list of the first row in the statement.
+ * @param rows The number of rows covered by the statement.
+ * @param affected The number of rows the database reports as affected.
+ * @param data The batch_data member of the database connection object.
+ */
+typedef void (*cq_batch_fn)(size_t first, size_t rows,
+        unsigned long long affected, void *data);
 
 /**
  * @brief The universal database connection auxiliary structure for cquel.
@@ -78,6 +146,17 @@ struct dbconn {
     const char *user;
     const char *passwd;
     const char *database;
+    struct cq_pool *pool;
+    size_t batch;
+    cq_batch_fn on_batch;
+    void *batch_data;
+    bool prepared;
+    struct cq_stmt_cache *stmts;
+    struct cq_ctx *ctx;
+    size_t commit_rows;
+    size_t commit_bytes;
+    size_t *committed;
+    struct cq_txn *txn;
 };
 
 /**
@@ -93,6 +172,9 @@ struct dbconn cq_new_connection(const char *host, const char *user,
 
 /**
  * @brief Connects to the database server.
+ *
+ * While the connection is open, other calls given this object reuse it rather
+ * than connecting on their own, allowing many operations in one session.
  * @param con Initialized database connection object.
  * @return Nonzero if an error occurred.
  */
@@ -106,18 +188,106 @@ void cq_close_connection(struct dbconn *con);
 
 /**
  * @brief Attempts to connect to and immediately disconnect from the database
- * server.
+ * server; pings the server instead if the connection is already open.
  * @param con Database connection object with connection details.
  * @return Nonzero if an error occurred.
  */
 int cq_test(struct dbconn con);
 
+/**
+ * @brief Creates a bounded pool of reusable database connections.
+ * @param con Database connection object with connection details; the strings
+ * it points to must outlive the pool.
+ * @param maxcon The maximum number of connections open at once.
+ * @param idle Seconds after which an unused connection is closed; 0 to keep
+ * idle connections open indefinitely.
+ * @return A pointer to the allocated pool or NULL on failure.
+ */
+struct cq_pool *cq_new_pool(struct dbconn con, size_t maxcon,
+        unsigned int idle);
+
+/**
+ * @brief Closes all idle connections and frees a connection pool.
+ * @param pool The pool to be freed; all connections must be checked in.
+ */
+void cq_free_pool(struct cq_pool *pool);
+
+/**
+ * @brief Leases an open connection from a pool, waiting for one to be checked
+ * in if the pool is exhausted.
+ * @param pool The pool from which to lease a connection.
+ * @param out Database connection object to receive the open connection.
+ * @return 0 on success; from 1 to 10 if input error; 200 if database
+ * connection error.
+ */
+int cq_pool_checkout(struct cq_pool *pool, struct dbconn *out);
+
+/**
+ * @brief Returns a leased connection to its pool after resetting its session
+ * state.
+ * @param pool The pool from which the connection was leased.
+ * @param con The leased database connection object.
+ */
+void cq_pool_checkin(struct cq_pool *pool, struct dbconn *con);
+
+/**
+ * @brief Closes the connections which have been idle longer than the pool's
+ * idle timeout.
+ * @param pool The pool to be trimmed.
+ * @return The number of connections closed.
+ */
+size_t cq_pool_trim(struct cq_pool *pool);
+
+/**
+ * @brief The kind of data held in a column, taken from the database for lists
+ * filled by a query.
+ */
+enum cq_type {
+    CQ_TEXT,
+    CQ_INT,
+    CQ_UINT,
+    CQ_DOUBLE,
+    CQ_DECIMAL,
+    CQ_TIME
+};
+
+/**
+ * @brief A DATE, DATETIME, TIMESTAMP or TIME value; fields absent from the
+ * column's type are zero.
+ */
+struct cq_time {
+    unsigned int year;
+    unsigned int month;
+    unsigned int day;
+    unsigned int hour;
+    unsigned int minute;
+    unsigned int second;
+    unsigned long usec;
+    bool neg;
+};
+
+/**
+ * @brief The binary form of a typed value, which typed rows keep alongside
+ * its text; CQ_DOUBLE and CQ_DECIMAL use d.
+ */
+union cq_native {
+    long long i;
+    unsigned long long u;
+    double d;
+    struct cq_time t;
+};
+
 /**
  * @brief Generic database row object to be added to a list.
  */
 struct drow {
     size_t fieldc;
     char **values;
+    size_t *lengths;
+    unsigned char *nulls;
+    union cq_native *natives;
+    const enum cq_type *types;
+    struct cq_arena *arena;
 
     struct drow *prev;
     struct drow *next;
@@ -132,20 +302,98 @@ struct drow *cq_new_drow(size_t fieldc);
 
 /**
  * @brief Frees all the memory allocated to an instantiated database row.
- * @param row The row to be freed.
+ * @param row The row to be freed; rows from an arena are left for their list
+ * to free.
  */
 void cq_free_drow(struct drow *row);
 
 /**
  * @brief Sets the values for each column in a row.
  * @param values An array of UTF-8 strings containing the data in the row; must
- * match the structure of fieldnames in the parent list; non-numeric values 
- * which do not begin with '\\' will be surrounded with apostrophes in queries 
- * to the database.
+ * match the structure of fieldnames in the parent list; values which do not
+ * begin with '\\' are quoted in queries to the database unless their column
+ * is numeric, or, in lists without types, unless they are all digits.
  * @return Nonzero if input error.
  */
 int cq_drow_set(struct drow *row, char * const *values);
 
+/**
+ * @brief Sets the value of one column in a row; the value may contain null
+ * bytes.
+ * @param row The row to be changed.
+ * @param index The index of the column to be set.
+ * @param value The bytes of the new value; can be NULL if len is 0.
+ * @param len The number of bytes in value.
+ * @return 0 on success; less than 0 if memory error; 4 if the value does not
+ * suit the type of a typed row's column; otherwise greater than 0 if input
+ * error.
+ */
+int cq_drow_set_value(struct drow *row, size_t index, const char *value,
+        size_t len);
+
+/**
+ * @brief Sets one column in a row to SQL NULL.
+ * @param row The row to be changed.
+ * @param index The index of the column to be set.
+ * @return 0 on success; greater than 0 if input error.
+ */
+int cq_drow_set_null(struct drow *row, size_t index);
+
+/**
+ * @brief Checks whether a column in a row holds SQL NULL; its value is then
+ * the empty string.
+ * @param row The row to be examined.
+ * @param index The index of the column.
+ * @return true if the column exists and holds NULL.
+ */
+bool cq_drow_is_null(const struct drow *row, size_t index);
+
+/**
+ * @brief Gets a value as a signed integer, without parsing if the column is
+ * typed CQ_INT.
+ * @param row The row to be read.
+ * @param index The index of the column.
+ * @param out Receives the value.
+ * @return 0 on success; 3 if the value is NULL; 4 if it is not an integer in
+ * range; otherwise greater than 0 if input error.
+ */
+int cq_drow_get_int(const struct drow *row, size_t index, long long *out);
+
+/**
+ * @brief Gets a value as an unsigned integer, without parsing if the column is
+ * typed CQ_UINT.
+ * @param row The row to be read.
+ * @param index The index of the column.
+ * @param out Receives the value.
+ * @return 0 on success; 3 if the value is NULL; 4 if it is not an unsigned
+ * integer in range; otherwise greater than 0 if input error.
+ */
+int cq_drow_get_uint(const struct drow *row, size_t index,
+        unsigned long long *out);
+
+/**
+ * @brief Gets a value as a double, without parsing if the column is typed
+ * CQ_DOUBLE or CQ_DECIMAL.
+ * @param row The row to be read.
+ * @param index The index of the column.
+ * @param out Receives the value.
+ * @return 0 on success; 3 if the value is NULL; 4 if it is not a number;
+ * otherwise greater than 0 if input error.
+ */
+int cq_drow_get_double(const struct drow *row, size_t index, double *out);
+
+/**
+ * @brief Gets a date or time value, without parsing if the column is typed
+ * CQ_TIME.
+ * @param row The row to be read.
+ * @param index The index of the column.
+ * @param out Receives the value.
+ * @return 0 on success; 3 if the value is NULL; 4 if it is not a date or time;
+ * otherwise greater than 0 if input error.
+ */
+int cq_drow_get_time(const struct drow *row, size_t index,
+        struct cq_time *out);
+
 /**
  * @brief A double linked list of database rows with metadata.
  */
@@ -153,6 +401,23 @@ struct dlist {
     size_t fieldc;
     char **fieldnames;
     char *primkey;
+    enum cq_type *types;
+
+    struct cq_arena *arena;
+    size_t heaprows;
+
+    size_t rowc;
+    struct drow **index;
+    size_t indexcap;
+    bool indexed;
+
+    size_t pindex;
+    size_t *fieldmap;
+    size_t fieldmapcap;
+
+    struct cq_keyindex *keys;
+
+    void *result;
 
     struct drow *first;
     struct drow *last;
@@ -171,7 +436,24 @@ struct dlist *cq_new_dlist(size_t fieldc, char * const *fieldnames,
         const char *primkey);
 
 /**
- * @brief Counts the number of members in a data list.
+ * @brief Makes a data list allocate its rows from large shared chunks which
+ * are all released when the list is freed.
+ * @param list The list which is to own an arena.
+ * @return Nonzero on failure.
+ */
+int cq_dlist_use_arena(struct dlist *list);
+
+/**
+ * @brief Instantiates a new row to be added to a data list, taken from the
+ * list's arena if it has one; rows for a list with types check values against
+ * them and must not outlive the list.
+ * @param list The list to which the row will be added.
+ * @return A pointer to the new row or NULL on failure.
+ */
+struct drow *cq_dlist_new_drow(struct dlist *list);
+
+/**
+ * @brief Gets the number of members in a data list in constant time.
  * @param list The list to be examined.
  * @return The number of rows in the list.
  */
@@ -184,7 +466,8 @@ size_t cq_dlist_size(const struct dlist *list);
 void cq_free_dlist(struct dlist *list);
 
 /**
- * @brief Adds a row to a data list.
+ * @brief Adds a row to a data list. Rows must be linked into a list with this
+ * function rather than by setting their pointers directly.
  * @param list The list to which to add the row.
  * @param row The row to be added.
  */
@@ -217,18 +500,54 @@ int cq_dlist_remove_field_str(struct dlist *list, const char *field);
  * @brief Removes a column from a data list by an index.
  * @param list The data list from which to remove the field.
  * @param index The index of the field to be removed.
- * @return Nonzero if invalid input.
+ * @return 0 on success; less than 0 if memory error; greater than 0 if
+ * invalid input.
  */
 int cq_dlist_remove_field_at(struct dlist *list, size_t index);
 
 /**
- * @brief Gets a row from a data list by index.
+ * @brief Gets a row from a data list by index. This takes constant time unless
+ * a row other than the last has been removed since the list was last added
+ * to, in which case the list is walked; it never changes the list, so a list
+ * may be read this way from several threads at once.
  * @param list The list through which to be searched.
  * @param index Number indicating which element to get.
  * @return Pointer to the row at that index or NULL on failure.
  */
 struct drow *cq_dlist_at(const struct dlist *list, size_t index);
 
+/**
+ * @brief Builds a hash index on the primary key of a data list, which is then
+ * kept up to date as rows are added and removed.
+ *
+ * The key of a row must not be changed while the row is in an indexed list.
+ * @param list The list to be indexed.
+ * @return 0 on success; less than 0 if memory error; 1 if list is NULL; 2 if
+ * the list's primary key is not one of its fields.
+ */
+int cq_dlist_index_key(struct dlist *list);
+
+/**
+ * @brief Finds a row in a data list by its primary key, using the list's key
+ * index if it has one.
+ * @param list The list through which to be searched.
+ * @param key The value of the primary key to be found.
+ * @return Pointer to the first row with that key or NULL if none.
+ */
+struct drow *cq_dlist_find(const struct dlist *list, const char *key);
+
+/**
+ * @brief Adds a row to a data list, or copies its values into the row already
+ * in the list with the same primary key.
+ * @param list The list to which to add the row.
+ * @param row The row to be added; on success the list takes ownership of it,
+ * freeing it if it is merged into an existing row.
+ * @return 0 on success; less than 0 if memory error; 1 if list is NULL; 2 if
+ * row is NULL; 3 if the row's field count does not match the list's; 4 if
+ * the list's primary key is not one of its fields.
+ */
+int cq_dlist_upsert_row(struct dlist *list, struct drow *row);
+
 /**
  * @brief Gets the index of a data list field by name.
  * @param list The list to be examined.
@@ -240,6 +559,15 @@ int cq_field_to_index(const struct dlist *list, const char *field, size_t *out);
 
 /**
  * @brief Inserts data into the database based on a data list.
+ *
+ * Rows are sent several at a time as multi-row INSERT statements, each holding
+ * at most con.batch rows (no limit if 0) and fitting in the query length.
+ *
+ * If con.commit_rows or con.commit_bytes is set, the statements run in a
+ * transaction which is committed once that many rows or bytes of values have
+ * been sent, and again at the end; on error the open transaction is rolled
+ * back. If con.committed is set, it receives the number of rows from the start
+ * of the list known to be committed.
  * @param con Database connection object with connection details.
  * @param table The database table to which to insert the data.
  * @param list The data list from which to insert data.
@@ -249,8 +577,55 @@ int cq_field_to_index(const struct dlist *list, const char *field, size_t *out);
  */
 int cq_insert(struct dbconn con, const char *table, const struct dlist *list);
 
+/**
+ * @brief Inserts a data list by splitting it into contiguous ranges of rows,
+ * each sent as by cq_insert() on its own thread and pooled connection.
+ *
+ * The ranges are independent, so if one fails the others may still have been
+ * inserted. The pool's batch callback, if any, is called from every thread and
+ * given row indices within the whole list. Each range commits in transactions
+ * of its own as by cq_insert(), but the pool's committed member is not set. The
+ * list must not be changed until this returns.
+ * @param pool The pool from which each thread leases a connection.
+ * @param table The database table to which to insert the data.
+ * @param list The data list from which to insert data.
+ * @param nthreads The number of ranges, and so of threads, to use; the
+ * calling thread sends one range itself.
+ * @param out_rows Destination for the total number of rows the database
+ * reports as inserted; can be NULL.
+ * @return 0 on success; otherwise the error of the first failed range, coded
+ * as for cq_insert().
+ */
+int cq_insert_parallel(struct cq_pool *pool, const char *table,
+        const struct dlist *list, size_t nthreads,
+        unsigned long long *out_rows);
+
+/**
+ * @brief Inserts data with LOAD DATA LOCAL INFILE, streaming the rows of a data
+ * list to the server as tab-separated text without writing them to disk.
+ *
+ * Rows are encoded one at a time as the server asks for more. Rows whose keys
+ * duplicate existing ones are skipped, as LOCAL implies IGNORE. If any value
+ * begins with '\\', the list is sent with cq_insert() instead.
+ * @param con Database connection object with connection details; the server
+ * must allow local_infile.
+ * @param table The database table to which to insert the data.
+ * @param list The data list from which to insert data.
+ * @return 0 on success; less than 0 if memory error; from 1 to 10 if input
+ * error; from 100 to 199 if query setup error; 200 if database connection
+ * error; 201 if error submitting query.
+ */
+int cq_load_dlist(struct dbconn con, const char *table,
+        const struct dlist *list);
+
 /**
  * @brief Updates data in a database table based on a data list.
+ *
+ * Rows are sent several at a time as single UPDATE statements which choose
+ * each column's new value with a CASE on the primary key, each holding at most
+ * con.batch rows (no limit if 0) and fitting in the query length. Rows of a
+ * list with a composite primary key are updated one statement at a time. Rows
+ * are committed in transactions as by cq_insert().
  * @param con Database connection object with connection details.
  * @param table The database table to which to update the data.
  * @param list The data list from which to derive the updated data.
@@ -271,6 +646,345 @@ int cq_update(struct dbconn con, const char *table, const struct dlist *list);
  */
 int cq_select_query(struct dbconn con, struct dlist **out, const char *query);
 
+/**
+ * @brief Receives each row streamed by cq_select_each().
+ * @param list An empty data list describing the fields of the result.
+ * @param row The current row; its storage is reused for the next row.
+ * @param data The data pointer passed to cq_select_each().
+ * @return Nonzero to stop receiving rows.
+ */
+typedef int (*cq_row_fn)(const struct dlist *list, struct drow *row,
+        void *data);
+
+/**
+ * @brief Streams the rows of a SELECT query to a callback one at a time,
+ * holding only the current row in memory.
+ *
+ * The connection is busy until every row has been read, so the callback must
+ * not issue queries on the same connection.
+ * @param con Database connection object with connection details.
+ * @param q UTF-8 SQL to be appended to "SELECT ".
+ * @param fn The function to be called for each row.
+ * @param data Pointer passed through to fn.
+ * @return 0 on success or if fn stopped early; less than 0 if memory error;
+ * from 1 to 10 if input error; from 100 to 199 if query setup error; 200 if
+ * database connection error; 201 if error submitting query; 202-299 if error
+ * parsing data.
+ */
+int cq_select_each(struct dbconn con, const char *q, cq_row_fn fn,
+        void *data);
+
+/**
+ * @brief The socket of an async query must become readable.
+ */
+#define CQ_WAIT_READ    1
+
+/**
+ * @brief The socket of an async query must become writable.
+ */
+#define CQ_WAIT_WRITE   2
+
+/**
+ * @brief The socket of an async query must have an exceptional condition.
+ */
+#define CQ_WAIT_EXCEPT  4
+
+/**
+ * @brief An async query is waiting on a client timeout.
+ */
+#define CQ_WAIT_TIMEOUT 8
+
+/**
+ * @brief Called once when an async query finishes.
+ * @param q The finished query; it must not be freed from the callback.
+ * @param data The data pointer passed to cq_async_query().
+ */
+typedef void (*cq_async_fn)(struct cq_async *q, void *data);
+
+/**
+ * @brief Starts a query without waiting for the server.
+ *
+ * The query runs on an open connection, one leased from the connection's pool,
+ * or a new one, as with the other connected functions; an open connection can
+ * carry only one query at a time. Leasing or opening that connection blocks,
+ * so an event loop should pass connections which are already open, or a pool
+ * with room to spare. Drive the query with cq_async_poll() or by waiting on
+ * cq_async_fd() for cq_async_events() and calling cq_async_resume(). A leased
+ * connection goes back to its pool as soon as the query finishes, and its
+ * session is reset when it is next leased rather than then. Without the
+ * MariaDB client library the query completes before this returns.
+ * @param con Database connection object with connection details.
+ * @param query The complete UTF-8 SQL to be run.
+ * @param done Function to be called when the query finishes; can be NULL.
+ * @param data Pointer passed through to done.
+ * @param out Receives the handle of the query, to be freed with
+ * cq_free_async().
+ * @return 0 if the query was started; less than 0 if memory error; from 1 to
+ * 10 if input error; 200 if database connection error.
+ */
+int cq_async_query(struct dbconn con, const char *query, cq_async_fn done,
+        void *data, struct cq_async **out);
+
+/**
+ * @brief Continues an async query once its socket is ready.
+ * @param q The query to be continued.
+ * @param ready The CQ_WAIT_* events which occurred.
+ * @return The events for which the query must next wait; 0 once it has
+ * finished.
+ */
+int cq_async_resume(struct cq_async *q, int ready);
+
+/**
+ * @brief Gets the socket on which an async query is waiting.
+ * @param q The query to be examined.
+ * @return The socket descriptor, or -1 if the query has finished.
+ */
+int cq_async_fd(const struct cq_async *q);
+
+/**
+ * @brief Gets the events for which an async query is waiting.
+ * @param q The query to be examined.
+ * @return A combination of the CQ_WAIT_* flags; 0 once it has finished.
+ */
+int cq_async_events(const struct cq_async *q);
+
+/**
+ * @brief Gets the timeout after which an async query waiting on
+ * CQ_WAIT_TIMEOUT is to be resumed with that event.
+ * @param q The query to be examined.
+ * @return The timeout in milliseconds.
+ */
+unsigned int cq_async_timeout(const struct cq_async *q);
+
+/**
+ * @brief Checks whether an async query has finished.
+ * @param q The query to be examined.
+ * @return true if the query has finished.
+ */
+bool cq_async_done(const struct cq_async *q);
+
+/**
+ * @brief Collects the outcome of a finished async query.
+ * @param q The finished query.
+ * @param out Receives the rows of the first result set, or NULL if the query
+ * returned none; the caller frees the list. Can be NULL.
+ * @return 0 on success; less than 0 if memory error; 1 if input error; 2 if
+ * the query has not finished; 201 if error submitting query; 202-299 if error
+ * parsing data.
+ */
+int cq_async_result(struct cq_async *q, struct dlist **out);
+
+/**
+ * @brief Gets the number of rows changed by a finished async query.
+ * @param q The finished query.
+ * @return The number of rows affected by the last statement without a result
+ * set.
+ */
+unsigned long long cq_async_affected(const struct cq_async *q);
+
+/**
+ * @brief Waits for any of a set of async queries to be ready and continues
+ * those which are.
+ * @param qs The queries to be driven; finished queries are skipped.
+ * @param n The number of queries in qs.
+ * @param timeout The longest time to wait in milliseconds, or -1 to wait
+ * until a query is ready.
+ * @return The number of queries still unfinished, or -1 on error.
+ */
+int cq_async_poll(struct cq_async * const *qs, size_t n, int timeout);
+
+/**
+ * @brief Frees an async query and any rows not collected from it. A query
+ * which has not finished is first run to completion, blocking until it does,
+ * so that its connection can be used again; its done function is not called.
+ * @param q The query to be freed.
+ */
+void cq_free_async(struct cq_async *q);
+
+/**
+ * @brief Creates an empty pipeline, a queue of statements sent to the server
+ * several to a packet.
+ * @return A pointer to the allocated pipeline or NULL on failure.
+ */
+struct cq_pipeline *cq_new_pipeline(void);
+
+/**
+ * @brief Queues a statement to be sent by cq_pipeline_run().
+ * @param p The pipeline to which to add the statement.
+ * @param query One UTF-8 SQL statement; a trailing ';' is optional.
+ * @return 0 on success; less than 0 if memory error; from 1 to 10 if input
+ * error.
+ */
+int cq_pipeline_add(struct cq_pipeline *p, const char *query);
+
+/**
+ * @brief Runs the statements of a pipeline in the order they were added.
+ *
+ * Statements are joined by ';' into as few packets as fit in the query length,
+ * or in the server's max_allowed_packet if the query length is 0, relying on
+ * the CLIENT_MULTI_STATEMENTS flag set by cq_connect(), and the results of each
+ * are read in turn. Rows returned by a statement are discarded. The server
+ * stops at the first statement which fails, and no later statement is run. A
+ * statement beginning with CALL is taken to answer with its status after its
+ * result sets. The pipeline may be run again.
+ * @param con Database connection object with connection details.
+ * @param p The pipeline to be run.
+ * @return 0 on success; from 1 to 10 if input error; 200 if database
+ * connection error; 201 if a statement failed.
+ */
+int cq_pipeline_run(struct dbconn con, struct cq_pipeline *p);
+
+/**
+ * @brief Gets the outcome of one statement of the last cq_pipeline_run().
+ * @param p The pipeline to be examined.
+ * @param index The index of the statement, in the order it was added.
+ * @param affected Destination for the number of rows the database reports as
+ * affected, or returned by a SELECT; can be NULL.
+ * @return 0 if the statement succeeded; 1 if input error; 2 if it was not run;
+ * 201 if it failed.
+ */
+int cq_pipeline_status(const struct cq_pipeline *p, size_t index,
+        unsigned long long *affected);
+
+/**
+ * @brief Gets the number of statements queued in a pipeline.
+ * @param p The pipeline to be examined.
+ * @return The number of statements.
+ */
+size_t cq_pipeline_size(const struct cq_pipeline *p);
+
+/**
+ * @brief Removes every statement from a pipeline so that it can be reused.
+ * @param p The pipeline to be cleared.
+ */
+void cq_pipeline_clear(struct cq_pipeline *p);
+
+/**
+ * @brief Frees a pipeline and the statements queued in it.
+ * @param p The pipeline to be freed.
+ */
+void cq_free_pipeline(struct cq_pipeline *p);
+
+/**
+ * @brief One column of a struct dcols.
+ *
+ * Values are stored back to back in data, each followed by a null byte.
+ * Value i begins at data + offsets[i] and is offsets[i+1] - offsets[i] - 1
+ * bytes long. Bit i of nulls is set when value i is SQL NULL.
+ */
+struct dcolumn {
+    char *name;
+    char *data;
+    size_t *offsets;
+    unsigned char *nulls;
+    size_t datacap;
+};
+
+/**
+ * @brief Query results stored column by column, for scanning a few columns
+ * of many rows.
+ */
+struct dcols {
+    size_t fieldc;
+    size_t rowc;
+    size_t rowcap;
+    struct dcolumn *columns;
+};
+
+/**
+ * @brief Receives the values of a column of a struct dcols.
+ * @param row The index of the row holding the value.
+ * @param value The value, or NULL if the value is SQL NULL.
+ * @param len The length of value in bytes.
+ * @param data The data pointer passed through by the caller.
+ * @return Nonzero to stop a scan or to select a row in a filter.
+ */
+typedef int (*cq_value_fn)(size_t row, const char *value, size_t len,
+        void *data);
+
+/**
+ * @brief Pulls the results of a SELECT query into columnar storage.
+ *
+ * Rows are streamed from the server directly into the column buffers.
+ * @param con Database connection object with connection details.
+ * @param out An unallocated column set into which the data will be inserted.
+ * @param q UTF-8 SQL to be appended to "SELECT ".
+ * @return 0 on success; less than 0 if memory error; from 1 to 10 if input
+ * error; from 100 to 199 if query setup error; 200 if database connection
+ * error; 201 if error submitting query; 202-299 if error parsing data.
+ */
+int cq_select_columns(struct dbconn con, struct dcols **out, const char *q);
+
+/**
+ * @brief Frees all memory allocated to a column set.
+ * @param cols The column set to be freed.
+ */
+void cq_free_dcols(struct dcols *cols);
+
+/**
+ * @brief Finds the index of a column by name.
+ * @param cols The column set to be searched.
+ * @param name The name of the column.
+ * @param out Pointer to the location to store the index.
+ * @return 0 on success; less than 0 if input error; 1 if no such column.
+ */
+int cq_dcols_index(const struct dcols *cols, const char *name, size_t *out);
+
+/**
+ * @brief Checks whether a value in a column set is SQL NULL.
+ * @param cols The column set.
+ * @param col The index of the column.
+ * @param row The index of the row.
+ * @return true if the value is NULL or there is no such value.
+ */
+bool cq_dcols_is_null(const struct dcols *cols, size_t col, size_t row);
+
+/**
+ * @brief Gets a value from a column set.
+ * @param cols The column set.
+ * @param col The index of the column.
+ * @param row The index of the row.
+ * @param len Optional pointer to the location to store the value's length.
+ * @return The null-terminated value; NULL if the value is SQL NULL or the
+ * indices are out of range.
+ */
+const char *cq_dcols_value(const struct dcols *cols, size_t col, size_t row,
+        size_t *len);
+
+/**
+ * @brief Calls a function for each value of a column in row order.
+ * @param cols The column set.
+ * @param col The index of the column to be scanned.
+ * @param fn The function to be called; a nonzero return stops the scan.
+ * @param data Pointer passed through to fn.
+ * @return 0 on success; 1 if the column is invalid; 2 if fn is NULL.
+ */
+int cq_dcols_scan(const struct dcols *cols, size_t col, cq_value_fn fn,
+        void *data);
+
+/**
+ * @brief Selects the rows whose value in a column satisfies a predicate.
+ * @param cols The column set.
+ * @param col The index of the column to be tested.
+ * @param fn The predicate; a nonzero return selects the row.
+ * @param data Pointer passed through to fn.
+ * @param out Array of at least cols->rowc elements to receive the indices
+ * of the selected rows in ascending order.
+ * @return The number of rows selected.
+ */
+size_t cq_dcols_filter(const struct dcols *cols, size_t col, cq_value_fn fn,
+        void *data, size_t *out);
+
+/**
+ * @brief Sums the numeric values of a column, skipping NULLs.
+ * @param cols The column set.
+ * @param col The index of the column to be summed.
+ * @param out Pointer to the location to store the sum.
+ * @return 0 on success; 1 if the column is invalid; 2 if out is NULL; 3 if
+ * a value is not numeric.
+ */
+int cq_dcols_sum(const struct dcols *cols, size_t col, double *out);
+
 /**
  * @brief Pulls a table from the database.
  * @param con Database connection object with connection details.
@@ -284,6 +998,38 @@ int cq_select_query(struct dbconn con, struct dlist **out, const char *query);
 int cq_select_all(struct dbconn con, const char *table, struct dlist **out,
         const char *conditions);
 
+/**
+ * @brief Receives each page read by cq_select_pages().
+ * @param page A data list holding the rows of the page; it is freed once this
+ * returns.
+ * @param data The data pointer passed to cq_select_pages().
+ * @return Nonzero to stop reading pages.
+ */
+typedef int (*cq_page_fn)(struct dlist *page, void *data);
+
+/**
+ * @brief Reads a table in pages of rows ordered by its primary key, holding
+ * only one page in memory at a time.
+ *
+ * Each page is selected with the rows whose key follows the last key of the
+ * page before, so that the server seeks along the primary key index rather
+ * than scanning past the rows already read. Rows changed between pages are
+ * seen as they are when their page is read. No result is open while the
+ * callback runs, so it may issue queries on the same connection.
+ * @param con Database connection object with connection details.
+ * @param table UTF-8 string matching the name of the table to be read.
+ * @param conditions UTF-8 SQL where_condition; can be NULL.
+ * @param pagelen The maximum number of rows in each page.
+ * @param fn The function to be called for each page.
+ * @param data Pointer passed through to fn.
+ * @return 0 on success or if fn stopped early; less than 0 if memory error;
+ * from 1 to 10 if input error, 4 if the table has no primary key; from 100 to
+ * 199 if query setup error; 200 if database connection error; 201 if error
+ * submitting query; 202-299 if error parsing data.
+ */
+int cq_select_pages(struct dbconn con, const char *table,
+        const char *conditions, size_t pagelen, cq_page_fn fn, void *data);
+
 /**
  * @brief Populates a dlist with the return value of a basic function call.
  * @param con Database connection object with connection details.
@@ -312,20 +1058,26 @@ int cq_select_func_drow(struct dbconn con, const char *func, struct drow row,
         struct dlist **out);
 
 /**
- * @brief Gets the name of the primary key of a database table.
+ * @brief Gets the name of the primary key of a database table, or the names
+ * of its columns in index order separated by commas if the key is composite.
+ *
+ * Results are kept in the connection context's cache keyed by host, database,
+ * and table until they expire or are invalidated with cq_meta_invalidate().
  * @param con Database connection object with connection details.
  * @param table UTF-8 string matching the name of the table to be examined.
  * @param out Buffer in which to store the result.
  * @param len Length of the out buffer.
  * @return 0 on success; less than 0 if memory error; from 1 to 10 if input
  * error; from 100 to 199 if query setup error; 200 if database connection
- * error; 201 if error submitting query; 202-299 if error parsing data.
+ * error; 201 if error submitting query; 202-299 if error parsing data, 203 if
+ * the table has no primary key, 204 if out is too short.
  */
 int cq_get_primkey(struct dbconn con, const char *table, char *out,
         size_t len);
 
 /**
- * @brief Gets information about the fields in a database table.
+ * @brief Gets information about the fields in a database table, using the
+ * same cache as cq_get_primkey().
  * @param con Database connection object with connection details.
  * @param table UTF-8 string matching the name of the table to be examined.
  * @param out_fieldc Destination for the number of fields; can be NULL.
@@ -338,8 +1090,35 @@ int cq_get_primkey(struct dbconn con, const char *table, char *out,
 int cq_get_fields(struct dbconn con, const char *table, size_t *out_fieldc,
         char **out_names, size_t nblen);
 
+/**
+ * @brief Discards cached metadata for tables of a connection's database, such
+ * as after altering a table.
+ * @param con Database connection object naming the host and database.
+ * @param table The table whose metadata is to be discarded, or NULL for every
+ * table in the database.
+ */
+void cq_meta_invalidate(struct dbconn con, const char *table);
+
+/**
+ * @brief Sets how long cached table metadata of the default context is used
+ * before it is looked up again; the default is 60 seconds.
+ * @param seconds The lifetime of cached metadata; 0 disables the cache.
+ */
+void cq_meta_set_ttl(unsigned int seconds);
+
+/**
+ * @brief Gets the number of metadata lookups served from and missing from the
+ * default context's cache since the program started.
+ * @param hits Destination for the number of cache hits; can be NULL.
+ * @param misses Destination for the number of cache misses; can be NULL.
+ */
+void cq_meta_stats(unsigned long long *hits, unsigned long long *misses);
+
 /**
  * @brief Calls a stored database procedure with an array of arguments.
+ *
+ * If con.prepared is set and no argument is prefixed with '\\', the call is
+ * made with a cached prepared statement.
  * @param con Database connection object with connection details.
  * @param proc The name of the procedure to call (without parentheses).
  * @param args UTF-8 string array of the arguments to the function; non-numeric